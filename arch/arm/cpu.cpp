@@ -51,6 +51,16 @@ bool psr::thumb() const {
     return raw_value & thumb_mask;
 }
 
+void enable_cycle_counter() {
+    uint32_t pmcr;
+    __asm__ __volatile__("mrc p15, 0, %0, c9, c12, 0" : "=r"(pmcr));
+    pmcr |= (1<<0) | (1<<2); // enable all counters, reset the cycle counter
+    pmcr &= ~(1U<<3);        // count every cycle, not every 64th
+    __asm__ __volatile__("mcr p15, 0, %0, c9, c12, 0" : : "r"(pmcr));
+    __asm__ __volatile__("mcr p15, 0, %0, c9, c12, 1" : : "r"(1U<<31)); // PMCNTENSET: cycle counter
+    __asm__ __volatile__("mcr p15, 0, %0, c9, c14, 0" : : "r"(1U));     // PMUSERENR: user mode access
+}
+
 uint32_t read_register(cpu_mode mode, cpu_register reg) {
     uint32_t value{};
     if(mode == psr::current().mode()) {
@@ -7,6 +7,7 @@
 #include <config.hpp>
 
 #include <initializer_list>
+#include <iterator>
 #include <cstdint>
 #include <utility>
 #include <tuple>
@@ -37,6 +38,25 @@ void enable()
     debug::kdebug("We are still alive after enabling interrupts.");
 }
 
+extern "C" {
+    void undefined_instruction();
+    void software_interrupt();
+    void prefetch_abort();
+    void data_abort();
+    void not_used();
+    void irq();
+    void fiq();
+    extern void (*_ivt_entries[])();
+}
+static void (*const trampolines[])() = {
+    &undefined_instruction, &software_interrupt, &prefetch_abort, &data_abort, &not_used, &irq, &fiq,
+};
+static_assert(std::size(trampolines) == std::to_underlying(interrupt_type::INTERRUPT_TYPE_COUNT));
+
+void set_vector_entry(interrupt_type type, void (*entry)()) {
+    _ivt_entries[std::to_underlying(type)] = entry ? entry : trampolines[std::to_underlying(type)];
+}
+
 static std::tuple<interrupt_handler, void*> interrupt_handlers[std::to_underlying(interrupt_type::INTERRUPT_TYPE_COUNT)];
 void set_handler(interrupt_type type, interrupt_handler handler, void* userdata) {
     interrupt_handlers[std::to_underlying(type)] = {handler, userdata};
@@ -46,6 +46,14 @@ void disable_source(interrupt_source source) {
         interrupt_controller->disable_irqs[0] = (1<<s);
     }
 }
+bool check_only_interrupt(interrupt_source source) {
+    uint32_t s = std::to_underlying(source);
+    if(s >= 32) {
+        return interrupt_controller->irq_pending[0] == 0 && interrupt_controller->irq_pending[1] == (1u<<(s-32));
+    } else {
+        return interrupt_controller->irq_pending[0] == (1u<<s) && interrupt_controller->irq_pending[1] == 0;
+    }
+}
 bool check_interrupt(interrupt_source source) {
     uint32_t s = std::to_underlying(source);
     if(s >= 32) {
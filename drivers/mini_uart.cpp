@@ -0,0 +1,168 @@
+#include <drivers/mini_uart.hpp>
+#include <arch/arm/cpu.hpp>
+#include <kernel/sync.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace kernel::driver::mini_uart {
+
+constexpr std::uintptr_t AUX_BASE = (0x7E215000 - 0x3F000000);
+constexpr uint32_t SYSTEM_CLOCK = 250000000;
+
+enum class enable_flags : uint32_t {
+    MINI_UART = (1<<0),
+};
+/**
+ * The BCM2835 datasheet has the two interrupt enable bits swapped,
+ * these are the values actually used by the hardware (and QEMU).
+ */
+enum class ier_flags : uint32_t {
+    RX = (1<<0),
+    TX = (1<<1),
+};
+enum class iir_flags : uint32_t {
+    CLEAR_RX_FIFO = (1<<1),
+    CLEAR_TX_FIFO = (1<<2),
+    FIFO_ENABLE   = (0b11<<6),
+};
+enum class lcr_flags : uint32_t {
+    DATA_8BIT = 0b11,
+};
+enum class lsr_flags : uint32_t {
+    /**
+     * This bit is set if the transmit FIFO can accept at least one byte.
+     */
+    TX_EMPTY = (1<<5),
+};
+enum class cntl_flags : uint32_t {
+    RX_ENABLE = (1<<0),
+    TX_ENABLE = (1<<1),
+};
+
+struct aux {
+    // Auxiliary Interrupt status
+    uint32_t irq;
+    // Auxiliary enables
+    uint32_t enables;
+
+    uint32_t unused1[14];
+
+    // Mini UART I/O Data
+    uint32_t io;
+    // Mini UART Interrupt Enable
+    uint32_t ier;
+    // Mini UART Interrupt Identify
+    uint32_t iir;
+    // Mini UART Line Control
+    uint32_t lcr;
+    // Mini UART Modem Control
+    uint32_t mcr;
+    // Mini UART Line Status
+    uint32_t lsr;
+    // Mini UART Modem Status
+    uint32_t msr;
+    // Mini UART Scratch
+    uint32_t scratch;
+    // Mini UART Extra Control
+    uint32_t cntl;
+    // Mini UART Extra Status
+    uint32_t stat;
+    // Mini UART Baudrate
+    uint32_t baud;
+};
+static_assert(offsetof(aux, irq) == 0x0);
+static_assert(offsetof(aux, enables) == 0x4);
+static_assert(offsetof(aux, io) == 0x40);
+static_assert(offsetof(aux, ier) == 0x44);
+static_assert(offsetof(aux, iir) == 0x48);
+static_assert(offsetof(aux, lcr) == 0x4c);
+static_assert(offsetof(aux, mcr) == 0x50);
+static_assert(offsetof(aux, lsr) == 0x54);
+static_assert(offsetof(aux, msr) == 0x58);
+static_assert(offsetof(aux, scratch) == 0x5c);
+static_assert(offsetof(aux, cntl) == 0x60);
+static_assert(offsetof(aux, stat) == 0x64);
+static_assert(offsetof(aux, baud) == 0x68);
+
+static volatile struct aux *const aux_controller = reinterpret_cast<struct aux*>(AUX_BASE);
+
+MiniUART MiniUart{};
+/** The TX ring takes one producer at a time, but any thread may be preempted in the middle of a `put`. */
+static mutex producers{};
+
+void MiniUART::begin(uint32_t baudrate) {
+    aux_controller->enables = aux_controller->enables | std::to_underlying(enable_flags::MINI_UART);
+    aux_controller->cntl = 0;
+    aux_controller->ier = 0;
+    aux_controller->lcr = std::to_underlying(lcr_flags::DATA_8BIT);
+    aux_controller->mcr = 0;
+    aux_controller->iir = std::to_underlying(iir_flags::CLEAR_RX_FIFO) | std::to_underlying(iir_flags::CLEAR_TX_FIFO) | std::to_underlying(iir_flags::FIFO_ENABLE);
+    aux_controller->baud = SYSTEM_CLOCK / (8 * baudrate) - 1;
+    aux_controller->cntl = std::to_underlying(cntl_flags::TX_ENABLE);
+}
+
+/**
+ * Whether the TX interrupt can drain the ring behind the caller's back. It cannot with interrupts masked
+ * (like in a panic) or in an exception mode (like an interrupt handler or an exception dump),
+ * which write directly instead.
+ */
+static bool can_buffer() {
+    auto current = cpu::psr::current();
+    auto mode = current.mode();
+    return !current.interrupt_mask().irq && (mode == cpu::cpu_mode::usr || mode == cpu::cpu_mode::sys);
+}
+static void write_polling(char ch) {
+    while(!(aux_controller->lsr & std::to_underlying(lsr_flags::TX_EMPTY)));
+    aux_controller->io = static_cast<uint8_t>(ch);
+}
+
+/**
+ * Writes out the whole ring by polling, for callers the TX interrupt cannot run concurrently to.
+ */
+static void drain_polling(ring_buffer<char, config::mini_uart_tx_buffer_size>& tx_buffer) {
+    char buffered;
+    while(tx_buffer.pop(buffered)) {
+        write_polling(buffered);
+    }
+}
+
+ostream& MiniUART::put(char ch) {
+    if(!can_buffer()) {
+        // whatever is still buffered goes first
+        drain_polling(tx_buffer);
+        write_polling(ch);
+        return *this;
+    }
+
+    lock_guard lock{producers};
+    if(!tx_buffer.push(ch)) {
+        m_dropped = m_dropped + 1;
+        return *this;
+    }
+    aux_controller->ier = std::to_underlying(ier_flags::TX);
+    return *this;
+}
+
+void MiniUART::flush() {
+    if(!can_buffer()) {
+        drain_polling(tx_buffer);
+        return;
+    }
+    while(!tx_buffer.empty());
+}
+
+void MiniUART::handle_interrupt() {
+    char ch;
+    while(aux_controller->lsr & std::to_underlying(lsr_flags::TX_EMPTY)) {
+        if(!tx_buffer.pop(ch)) {
+            // nothing left to send, so stop asking for TX interrupts until the next put
+            aux_controller->ier = 0;
+            return;
+        }
+        aux_controller->io = static_cast<uint8_t>(ch);
+    }
+}
+
+}
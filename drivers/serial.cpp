@@ -1,8 +1,11 @@
 #include <drivers/serial.hpp>
+#include <arch/arm/cpu.hpp>
 #include <kernel/events.hpp>
+#include <kernel/threads.hpp>
 
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <utility>
 
 namespace kernel::driver::serial {
@@ -170,9 +173,24 @@ ostream& PL011::put(char ch) {
     return *this;
 }
 int PL011::get() {
-    while(uart_controller->fr & static_cast<uint32_t>(fr_flags::RXFE));
+    // only threads can block, the interrupt handler (or anything else in an exception mode) has to poll
+    auto mode = cpu::psr::current().mode();
+    bool can_block = mode == cpu::cpu_mode::usr || mode == cpu::cpu_mode::sys;
+    for(;;) {
+        uint32_t sequence = threads::wait_sequence(threads::wait_source::uart);
+        if(!(uart_controller->fr & static_cast<uint32_t>(fr_flags::RXFE))) {
+            break;
+        }
+        if(can_block) {
+            blocked_readers++;
+            threads::wait_for(threads::wait_source::uart, sequence);
+            blocked_readers--;
+        }
+    }
 
     uint32_t read = uart_controller->dr;
+    // the character is taken, the interrupt may pass the next ones to the event loop again
+    uart_controller->imsc = uart_controller->imsc | std::to_underlying(interrupt_flags::RX);
     return read & 0xff;
 }
 int PL011::available() const {
@@ -185,9 +203,22 @@ int PL011::available() const {
 void PL011::handle_interrupt() {
     uint32_t mis = uart_controller->mis;
     uart_controller->icr = uart_controller->mis;
-    if(mis & std::to_underlying(interrupt_flags::RX)) {
+    if((mis & std::to_underlying(interrupt_flags::RX)) && blocked_readers.load(std::memory_order_relaxed)) {
+        // leave the character to the blocked thread, and mask the interrupt until it has read it
+        uart_controller->imsc = uart_controller->imsc & ~std::to_underlying(interrupt_flags::RX);
+        threads::wake_from_interrupt(threads::wait_source::uart);
+    } else if(mis & std::to_underlying(interrupt_flags::RX)) {
+        events::event batch[16];
+        std::size_t count = 0;
         while(!(uart_controller->fr & static_cast<uint32_t>(fr_flags::RXFE))) {
-            events::main_event_loop.fire_event(events::event{events::type::serial_rx, static_cast<uint32_t>(get())});
+            batch[count++] = events::event{events::type::serial_rx, static_cast<uint32_t>(get())};
+            if(count == std::size(batch)) {
+                events::main_event_loop.fire_events({batch, count});
+                count = 0;
+            }
+        }
+        if(count > 0) {
+            events::main_event_loop.fire_events({batch, count});
         }
     }
 }
@@ -196,4 +227,5 @@ void PL011::handle_interrupt() {
 
 namespace kernel::debug {
     ostream* debug_stream = &driver::serial::Serial;
+    ostream* log_stream = &driver::serial::Serial;
 }
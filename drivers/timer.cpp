@@ -33,17 +33,47 @@ void setup(system_timer timer, uint32_t interval, timer_func func, void *userdat
     debug::kdebug("Configured timer {} with interval {} (current value is {} and compare is {}).", t, interval, current, next);
 }
 
+bool set_alarm(system_timer timer, uint32_t at, timer_func func, void* userdata) {
+    unsigned int t = std::to_underlying(timer);
+
+    // an interval of 0 marks a one-shot timer
+    timer_configs[t] = {0, func, userdata};
+    timer_controller->cc[t] = at;
+    timer_controller->cs = (1<<t);
+
+    return static_cast<int32_t>(at - timer_controller->clo) > 0;
+}
+
+uint64_t now() {
+    uint32_t hi = timer_controller->chi;
+    uint32_t lo = timer_controller->clo;
+    if(hi != timer_controller->chi) { // the low word wrapped around while we were reading it
+        hi = timer_controller->chi;
+        lo = timer_controller->clo;
+    }
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+void acknowledge(system_timer timer) {
+    timer_controller->cs = (1<<std::to_underlying(timer));
+}
+
 void reset(system_timer timer, interrupt_context& context) {
     unsigned int t = std::to_underlying(timer);
     const auto& [delay, func, userdata] = timer_configs[t];
 
     uint32_t current = timer_controller->clo;
-    uint32_t next = current + delay;
-    timer_controller->cc[t] = next;
+    if(delay) {
+        uint32_t next = current + delay;
+        timer_controller->cc[t] = next;
+        debug::ktrace("Reset timer {} compare to {} (current timer value is {})", t, next, current);
+    }
     timer_controller->cs = (1<<t);
-    debug::ktrace("Reset timer {} compare to {} (current timer value is {})", t, next, current);
 
-    func(timer, current, context, userdata);
+    // the compare register of a channel that was enabled before its first alarm can match at any time
+    if(func) {
+        func(timer, current, context, userdata);
+    }
 }
 
 }
@@ -23,6 +23,20 @@ enum class cpu_register {
 };
 uint32_t read_register(cpu_mode mode, cpu_register reg);
 
+/**
+ * Starts the cycle counter of the performance monitors and allows reading it in user mode.
+ * Must be called in a privileged mode.
+ */
+void enable_cycle_counter();
+/**
+ * Returns the number of CPU cycles since `enable_cycle_counter`, wraps around after 2^32 cycles.
+ */
+inline uint32_t cycle_counter() {
+    uint32_t value;
+    __asm__ __volatile__("mrc p15, 0, %0, c9, c13, 0" : "=r"(value));
+    return value;
+}
+
 enum class cpu_endianness {
     little = 0,
     big = 1
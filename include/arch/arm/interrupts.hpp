@@ -42,6 +42,12 @@ namespace kernel::cpu::interrupts {
     void set_handler(interrupt_type type, interrupt_handler handler, void* userdata);
     void set_handler(std::initializer_list<interrupt_type> types, interrupt_handler handler, void* userdata);
 
+    /**
+     * Makes the vector table jump to `entry` for `type`, instead of the trampoline that calls `handle_interrupt`.
+     * `entry` runs in the exception mode with nothing saved. `nullptr` installs the trampoline again.
+     */
+    void set_vector_entry(interrupt_type type, void (*entry)());
+
     extern "C" void handle_interrupt(interrupt_type type, interrupt_registers* registers);
 }
 
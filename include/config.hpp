@@ -12,11 +12,48 @@ namespace kernel {
 namespace kernel::config {
 
 constexpr std::size_t malloc_memory_size = 0x8000;
-constexpr std::size_t event_queue_size = 1024;
+constexpr std::size_t event_queue_size = 1024; // per priority class, must be a power of two
+/**
+ * Events are queued in one ring per priority class (high, normal, low).
+ * With strict dispatch, a class only gets the budget left over by the classes above it.
+ * Otherwise every class may take up to its weight of events per round, so low priority events cannot starve.
+ */
+constexpr bool event_dispatch_strict = false;
+constexpr std::size_t event_priority_weights[] = {16, 4, 1};
+/**
+ * Maximum number of events, and separately of yields, an event loop processes per step
+ * before giving other threads a chance to run.
+ */
+constexpr std::size_t event_loop_budget = 32;
+constexpr std::size_t serial_subscription_size = 64;
+/**
+ * Record dispatch latency histograms per event type and run times per coroutine on every event loop,
+ * measured with the cycle counter.
+ */
+constexpr bool event_loop_instrumentation = true;
+constexpr std::size_t instrumentation_coroutine_slots = 32; // must be a power of two
+/**
+ * Number of distinct coroutine names and creation sites, which are shared by all frames instead of stored in each one.
+ * Must be a power of two.
+ */
+constexpr std::size_t coroutine_descriptor_slots = 64;
+/**
+ * Interval of the `tick` event in microseconds. Event loops only run the tick timer while a coroutine waits for it.
+ */
+constexpr uint32_t event_loop_tick_interval = 10000;
 constexpr uint32_t system_timer_interval = 1000000;
 
 constexpr log_level minimum_log_level = log_level::info;
 constexpr bool log_print_function = false;
+/**
+ * Route log messages to the mini UART instead of the console.
+ * QEMU exposes the mini UART as the second serial port (e.g. `-serial mon:stdio -serial file:kernel.log`).
+ */
+constexpr bool log_to_mini_uart = false;
+constexpr std::size_t mini_uart_tx_buffer_size = 0x1000;
+
+constexpr std::size_t telemetry_max_frame_size = 64;
+constexpr std::size_t telemetry_sample_buffer_size = 64;
 
 constexpr std::size_t mode_stack_size = 0x100000;
 
@@ -41,5 +78,23 @@ const inline struct {
 constexpr std::size_t thread_count = 32;
 constexpr std::size_t thread_stack_size = 0x10000;
 constexpr std::size_t idle_thread_stack_size = 0x1000;
+/**
+ * Number of thread priorities (at most 32). A ready thread of a higher priority always runs first
+ * and preempts lower ones as soon as it becomes ready, threads of the same priority take turns.
+ */
+constexpr uint32_t thread_priorities = 8;
+constexpr uint32_t thread_default_priority = 2;
+/**
+ * Priority of the thread that starts the kernel and runs the main event loop, which serves the console.
+ */
+constexpr uint32_t main_thread_priority = 6;
+/**
+ * How long a thread of each priority runs before the next ready thread of the same priority gets its turn, in microseconds.
+ */
+constexpr uint32_t thread_timeslices[thread_priorities] = {100000, 50000, 20000, 20000, 10000, 10000, 5000, 5000};
+/**
+ * Number of worker threads running blocking work for coroutines, see `kernel::offload`.
+ */
+constexpr std::size_t offload_workers = 2;
 
 }
@@ -26,4 +26,8 @@ namespace kernel::driver::interrupts {
     void enable_source(interrupt_source);
     void disable_source(interrupt_source);
     bool check_interrupt(interrupt_source);
+    /**
+     * Whether `source` is the only pending interrupt.
+     */
+    bool check_only_interrupt(interrupt_source);
 }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <config.hpp>
+#include <lib/io.hpp>
+#include <lib/ring_buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace kernel::driver::mini_uart {
+
+/**
+ * Driver for the mini UART of the BCM2835 auxiliary peripherals.
+ *
+ * The mini UART is output only and buffers everything threads write to it in a TX ring,
+ * which is drained by its interrupt handler. Interrupt handlers and code running with interrupts masked
+ * write synchronously instead, so their output is not lost when the ring cannot be drained. This makes it suitable as a dedicated
+ * high-rate log channel that does not interfere with the console on the PL011.
+ * QEMU exposes it as the second `-serial` device.
+ */
+class MiniUART : public ostream {
+    public:
+        constexpr MiniUART() = default;
+        ~MiniUART() = default;
+
+        void begin(uint32_t baudrate = 115200);
+
+        /**
+         * Queues a character for transmission, or writes it right away if the interrupt cannot drain the ring.
+         * If the TX ring is full, the character is dropped and counted.
+         */
+        ostream& put(char ch) override;
+        /**
+         * Busy waits until the TX ring has been drained by the interrupt handler,
+         * or drains it by polling the transmitter if the interrupt cannot run.
+         */
+        void flush();
+        void handle_interrupt();
+
+        std::size_t buffered() const {
+            return tx_buffer.size();
+        }
+        std::size_t dropped() const {
+            return m_dropped;
+        }
+
+        void operator delete([[maybe_unused]] MiniUART* p, std::destroying_delete_t) {}
+    private:
+        ring_buffer<char, config::mini_uart_tx_buffer_size> tx_buffer{};
+        volatile std::size_t m_dropped = 0;
+};
+
+extern MiniUART MiniUart;
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include <lib/io.hpp>
@@ -16,6 +17,10 @@ class PL011 : public ostream, public istream, public async_istream {
         void begin(uint32_t baudrate = 0);
 
         ostream& put(char ch) override;
+        /**
+         * Reads the next character. A thread blocks until it arrives, without using any CPU time,
+         * and takes it before it is passed to the event loop.
+         */
         int get() override;
         using istream::get;
 
@@ -26,6 +31,9 @@ class PL011 : public ostream, public istream, public async_istream {
         void handle_interrupt();
 
         void operator delete([[maybe_unused]] PL011* p, std::destroying_delete_t) {}
+    private:
+        /** Number of threads blocked in `get`, received characters are left to them while there are any. */
+        std::atomic<uint32_t> blocked_readers{0};
 };
 
 extern PL011 Serial;
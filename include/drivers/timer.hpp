@@ -20,6 +20,21 @@ using interrupt_context = cpu::interrupts::interrupt_context;
 using timer_func = std::add_pointer_t<void(system_timer, uint32_t, interrupt_context&, void*)>;
 
 void setup(system_timer timer, uint32_t interval, timer_func func, void* userdata);
+/**
+ * Configures `timer` to call `func` once, when the counter reaches `at`.
+ * Returns `false` if `at` has already passed by the time the compare register is written,
+ * the interrupt would only fire after the counter wrapped around in that case.
+ */
+bool set_alarm(system_timer timer, uint32_t at, timer_func func, void* userdata);
 void reset(system_timer timer, interrupt_context& context);
+/**
+ * Clears the pending interrupt of a one-shot timer without calling its function.
+ */
+void acknowledge(system_timer timer);
+
+/**
+ * Returns the value of the free running 1 MHz system timer counter (i.e. microseconds since boot).
+ */
+uint64_t now();
 
 }
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+
+#include <cstdint>
+
+namespace kernel::benchmarks {
+
+/**
+ * Floods the event queue of the main event loop from a system timer interrupt.
+ * Every `interval` microseconds `events_per_interrupt` events of type `user` are fired,
+ * one of them with high priority and the rest with their default (low) priority,
+ * for a total of `duration` microseconds.
+ * Afterwards it reports how many events were fired, received and lost to overruns,
+ * and the dispatch latency of every priority class.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> stress_event_queue(uint32_t duration, uint32_t interval, uint32_t events_per_interrupt,
+    coroutine_name = "stress events");
+
+/**
+ * Measures event dispatch with `waiters` coroutines waiting for events of type `user` at the same time.
+ * Runs once with every waiter filtering for its own event data and once with unfiltered waiters,
+ * which are all resumed by every event.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_waiters(uint32_t waiters, uint32_t rounds,
+    coroutine_name = "bench waiters");
+
+/**
+ * Arms `count` timers with deadlines spread over `spread` microseconds on the current event loop,
+ * cancels every fourth of them and reports the cost of adding and cancelling,
+ * as well as the slack (behind the deadline) and latency (behind the wheel tick) when they fire.
+ * Finally parks a thread with a deadline too far ahead for one alarm and wakes it early.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_timers(uint32_t count, uint32_t spread,
+    coroutine_name = "bench timers");
+
+/**
+ * Starts `count` coroutines on the current event loop that each yield `rounds` times,
+ * every fourth of them with a weight of `weight`.
+ * Reports the cost per yield and how evenly the ready queue served them
+ * at the moment the first one finished.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_yields(uint32_t count, uint32_t rounds, uint32_t weight,
+    coroutine_name = "bench yields");
+
+/**
+ * Passes `messages` timestamped messages through a `channel` on the current event loop,
+ * once from one producer to one consumer and once between four producers and four consumers,
+ * and compares them to posting the same messages to the event loop, which dispatches them as `user` events.
+ * Reports the cost per message and the latency from sending to receiving.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_channels(uint32_t messages,
+    coroutine_name = "bench channels");
+
+/**
+ * Compares the cost of `rounds` switches into and out of a `fiber`, calls of `threads::yield`
+ * (alone and switching between two threads, through both the generic and the assembly path)
+ * and resumptions of a generator and an async generator coroutine, in cycles per switch.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_switches(uint32_t rounds,
+    coroutine_name = "bench switches");
+
+/**
+ * Measures how late a periodically sleeping thread wakes up while `busy` threads of a low priority spin,
+ * once with the sleeper at their priority and once above them.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_priorities(uint32_t busy,
+    coroutine_name = "bench priorities");
+
+/**
+ * Compares how much CPU time `count` threads take while they repeatedly wait for a while,
+ * polling the system timer versus blocking in `threads::sleep_for`.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_sleepers(uint32_t count,
+    coroutine_name = "bench sleepers");
+
+/**
+ * Measures how long joining a thread that sleeps for a millisecond takes, `rounds` times,
+ * with the joining thread spinning on a flag versus parked in `thread::join`.
+ * Blocks the event loop while it runs.
+ */
+[[nodiscard("The coroutine must be awaited.")]] coroutine<void> bench_joins(uint32_t rounds,
+    coroutine_name = "bench joins");
+
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+#include <kernel/events.hpp>
+#include <kernel/task_group.hpp>
+#include <kernel/timers.hpp>
+#include <drivers/timer.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace kernel {
+
+namespace detail {
+    class cancel_scope_base;
+}
+
+/**
+ * Requests cancellation of the coroutines awaited with `cancellable(..., token)`.
+ *
+ * Cancelling destroys the frame of the awaited coroutine (and with it every coroutine it is waiting for),
+ * which unlinks whatever they are waiting on. The coroutine awaiting `cancellable` is resumed with `std::nullopt`.
+ * The frames are torn down on the next step of the event loop, so `cancel` may be called from
+ * the cancelled coroutines themselves, but only from the thread running their event loop.
+ * A token stays cancelled until it is reset.
+ */
+class cancellation_token {
+    public:
+        constexpr cancellation_token() = default;
+        cancellation_token(const cancellation_token&) = delete;
+        cancellation_token& operator=(const cancellation_token&) = delete;
+
+        void cancel();
+        bool cancelled() const {
+            return m_cancelled;
+        }
+        void reset() {
+            m_cancelled = false;
+        }
+    private:
+        bool m_cancelled = false;
+        detail::cancel_scope_base* scope = nullptr;
+
+        friend class detail::cancel_scope_base;
+};
+
+namespace detail {
+    /**
+     * Runs a child coroutine until it finishes, its deadline passes or its token is cancelled.
+     * The child is cancelled from a timer callback, when neither it nor its caller is running.
+     */
+    class cancel_scope_base : protected completion, private timers::timer {
+        public:
+            cancel_scope_base(const cancel_scope_base&) = delete;
+            cancel_scope_base& operator=(const cancel_scope_base&) = delete;
+
+            /**
+             * Tears the child down on the next step of the event loop.
+             */
+            void cancel_soon() {
+                timer::cancel();
+                loop->add_timer(this, 0);
+            }
+        protected:
+            std::coroutine_handle<> child;
+            std::coroutine_handle<> waiter = nullptr;
+            events::event_loop* loop = nullptr;
+            uint64_t timeout;
+            bool finished = false;
+            bool starting = false;
+
+            cancel_scope_base(std::coroutine_handle<> child, uint64_t timeout, cancellation_token* token)
+                : completion{&complete, nullptr, token}, timer(&expire, this), child(child), timeout(timeout) {}
+            ~cancel_scope_base() {
+                unregister();
+                if(child) {
+                    child.destroy();
+                }
+            }
+
+            bool suspend(std::coroutine_handle<> caller) {
+                if(!child) {
+                    debug::kerror("Tried to await an empty coroutine with a timeout: {}", child.address());
+                    return false;
+                }
+                if(token && token->cancelled()) {
+                    return false;
+                }
+                loop = get_event_loop(caller);
+                if(!loop) {
+                    panic("Event loop is null");
+                }
+                waiter = caller;
+                if(token) {
+                    if(token->scope) {
+                        panic("Cancellation token is already used by another coroutine");
+                    }
+                    token->scope = this;
+                }
+                starting = true;
+                start_child(child, this, loop, caller);
+                starting = false;
+                if(finished) {
+                    unregister();
+                    return false;
+                }
+                if(timeout) {
+                    loop->add_timer(this, driver::timer::now() + timeout);
+                }
+                set_coroutine_state(caller, coroutine_state::waiting_coroutine);
+                loop->current_coroutine = nullptr;
+                return true;
+            }
+        private:
+            void unregister() {
+                if(token && token->scope == this) {
+                    token->scope = nullptr;
+                }
+            }
+            static std::coroutine_handle<> complete(completion* self, std::coroutine_handle<>) {
+                auto* scope = static_cast<cancel_scope_base*>(self);
+                scope->finished = true;
+                scope->timer::cancel();
+                scope->unregister();
+                if(scope->starting) {
+                    return std::noop_coroutine();
+                }
+                scope->loop->current_coroutine = scope->waiter;
+                return scope->waiter;
+            }
+            static void expire(timers::timer&, void* userdata) {
+                auto* scope = static_cast<cancel_scope_base*>(userdata);
+                debug::ktrace("Cancelling coroutine {} awaited by coroutine {}",
+                    get_coroutine_info(scope->child), get_coroutine_info(scope->waiter));
+                scope->unregister();
+                std::exchange(scope->child, nullptr).destroy();
+                scope->loop->resume(scope->waiter);
+            }
+    };
+
+    template<typename T>
+    class cancel_scope : cancel_scope_base {
+        public:
+            cancel_scope(coroutine<T>&& child, uint64_t timeout, cancellation_token* token)
+                : cancel_scope_base(child.release(), timeout, token) {}
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return false;
+            }
+            bool await_suspend(std::coroutine_handle<> caller) noexcept {
+                return suspend(caller);
+            }
+            std::optional<result_t<T>> await_resume() {
+                if(!finished) {
+                    return std::nullopt;
+                }
+                if constexpr(std::is_void_v<T>) {
+                    return result_t<T>{};
+                } else {
+                    return std::move(std::coroutine_handle<promise<T>>::from_address(child.address()).promise().result);
+                }
+            }
+    };
+
+    template<typename Awaitable>
+    using await_result_t = decltype(std::declval<Awaitable&>().await_resume());
+
+    template<typename Awaitable>
+    struct is_coroutine : std::false_type {};
+    template<typename T>
+    struct is_coroutine<coroutine<T>> : std::true_type {};
+
+    /**
+     * Gives a plain awaitable (e.g. an `events::awaiter`) a frame of its own, so it can be cancelled.
+     * The awaitable is moved into the frame, so it has to be movable.
+     */
+    template<typename Awaitable> requires(!std::is_void_v<await_result_t<Awaitable>>)
+    coroutine<await_result_t<Awaitable>> await_in_frame(Awaitable awaitable, coroutine_name = "cancellable awaiter") {
+        co_return co_await awaitable;
+    }
+    template<typename Awaitable> requires(std::is_void_v<await_result_t<Awaitable>>)
+    coroutine<void> await_in_frame(Awaitable awaitable, coroutine_name = "cancellable awaiter") {
+        co_await awaitable;
+    }
+
+    template<typename Awaitable>
+    auto make_cancel_scope(Awaitable&& awaitable, uint64_t timeout, cancellation_token* token) {
+        if constexpr(is_coroutine<std::remove_cvref_t<Awaitable>>::value) {
+            return cancel_scope{std::move(awaitable), timeout, token};
+        } else {
+            return cancel_scope{await_in_frame(std::forward<Awaitable>(awaitable)), timeout, token};
+        }
+    }
+
+    inline cancellation_token* find_cancellation_token(std::coroutine_handle<> handle) {
+        while(handle) {
+            auto& promise = std::coroutine_handle<promise_base_base>::from_address(handle.address()).promise();
+            if(promise.completion) {
+                if(promise.completion->token) {
+                    return promise.completion->token;
+                }
+                handle = promise.completion->owner;
+            } else {
+                handle = promise.parent;
+            }
+        }
+        return nullptr;
+    }
+}
+
+inline void cancellation_token::cancel() {
+    m_cancelled = true;
+    if(scope) {
+        scope->cancel_soon();
+    }
+}
+
+/**
+ * Awaits `awaitable` (a coroutine or any other awaiter) until it finishes or `token` is cancelled.
+ * Returns the result, `std::monostate` for void, or `std::nullopt` if it was cancelled.
+ */
+template<typename Awaitable>
+[[nodiscard("The awaiter must be awaited.")]] auto cancellable(Awaitable&& awaitable, cancellation_token& token) {
+    return detail::make_cancel_scope(std::forward<Awaitable>(awaitable), 0, &token);
+}
+/**
+ * Awaits `awaitable` (a coroutine or any other awaiter) for at most `timeout` microseconds.
+ * Returns the result, `std::monostate` for void, or `std::nullopt` if it timed out.
+ */
+template<typename Awaitable>
+[[nodiscard("The awaiter must be awaited.")]] auto with_timeout(Awaitable&& awaitable, uint64_t timeout) {
+    return detail::make_cancel_scope(std::forward<Awaitable>(awaitable), timeout, nullptr);
+}
+template<typename Awaitable>
+[[nodiscard("The awaiter must be awaited.")]] auto with_timeout(Awaitable&& awaitable, uint64_t timeout, cancellation_token& token) {
+    return detail::make_cancel_scope(std::forward<Awaitable>(awaitable), timeout, &token);
+}
+
+/**
+ * Returns the token of the innermost `cancellable` scope the awaiting coroutine runs in,
+ * following its callers (and the owners of task groups) upwards, or `nullptr`.
+ * Long running loops can use it to stop early instead of being torn down.
+ */
+class get_cancellation_token {
+    cancellation_token* token = nullptr;
+public:
+    bool await_ready() const noexcept {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        token = detail::find_cancellation_token(handle);
+        return false;
+    }
+    cancellation_token* await_resume() const noexcept {
+        return token;
+    }
+};
+
+}
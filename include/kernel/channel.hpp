@@ -0,0 +1,210 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+#include <kernel/events.hpp>
+#include <lib/list.hpp>
+
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace kernel {
+
+/**
+ * A bounded channel passing values of type `T` from coroutines to coroutines, with room for `N` buffered values.
+ *
+ * Values are moved, never copied, so `T` may be move-only, and they are stored inline without allocating.
+ * Any number of coroutines may send and receive at the same time. A receiver waiting for a value gets it
+ * handed over directly by the next sender and is resumed right away, without going through the event queue
+ * (and vice versa for senders waiting for room). With `N == 0` every send waits for a receiver.
+ *
+ * All coroutines using a channel must run on the same event loop.
+ */
+template<typename T, std::size_t N>
+class channel {
+    public:
+        constexpr channel() = default;
+        channel(const channel&) = delete;
+        channel& operator=(const channel&) = delete;
+        ~channel() {
+            if(!senders.empty() || !receivers.empty()) {
+                panic("Channel destroyed while coroutines are waiting on it");
+            }
+            while(count > 0) {
+                pop();
+            }
+        }
+
+        class send_awaiter : public list_mixin<send_awaiter> {
+            channel* ch;
+            T value;
+            std::coroutine_handle<> handle = nullptr;
+            bool sent = false;
+        public:
+            send_awaiter(channel* ch, T&& value) : ch(ch), value(std::move(value)) {}
+            ~send_awaiter() {
+                // the coroutine frame might be destroyed while waiting
+                this->unlink();
+            }
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return false;
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                if(ch->closed) {
+                    return false;
+                }
+                if(auto* r = ch->receivers.pop_front()) {
+                    r->value.emplace(std::move(value));
+                    sent = true;
+                    ch->wake(r->handle, handle);
+                    return false;
+                }
+                if(ch->count < N) {
+                    ch->push(std::move(value));
+                    sent = true;
+                    return false;
+                }
+                this->handle = handle;
+                set_coroutine_state(handle, coroutine_state::waiting_channel);
+                ch->senders.push_back(this);
+                if(auto loop = get_event_loop(handle)) {
+                    loop->current_coroutine = nullptr;
+                }
+                return true;
+            }
+            /**
+             * Returns `false` if the channel has been closed and the value was dropped.
+             */
+            bool await_resume() const noexcept {
+                return sent;
+            }
+            friend channel;
+        };
+        class receive_awaiter : public list_mixin<receive_awaiter> {
+            channel* ch;
+            std::optional<T> value;
+            std::coroutine_handle<> handle = nullptr;
+        public:
+            receive_awaiter(channel* ch) : ch(ch) {}
+            ~receive_awaiter() {
+                // the coroutine frame might be destroyed while waiting
+                this->unlink();
+            }
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return false;
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                if(ch->count > 0) {
+                    value.emplace(ch->pop());
+                    // a waiting sender takes the free slot
+                    if(auto* s = ch->senders.pop_front()) {
+                        ch->push(std::move(s->value));
+                        s->sent = true;
+                        ch->wake(s->handle, handle);
+                    }
+                    return false;
+                }
+                if(auto* s = ch->senders.pop_front()) {
+                    value.emplace(std::move(s->value));
+                    s->sent = true;
+                    ch->wake(s->handle, handle);
+                    return false;
+                }
+                if(ch->closed) {
+                    return false;
+                }
+                this->handle = handle;
+                set_coroutine_state(handle, coroutine_state::waiting_channel);
+                ch->receivers.push_back(this);
+                if(auto loop = get_event_loop(handle)) {
+                    loop->current_coroutine = nullptr;
+                }
+                return true;
+            }
+            /**
+             * Returns `std::nullopt` if the channel has been closed and is empty.
+             */
+            std::optional<T> await_resume() noexcept {
+                return std::move(value);
+            }
+            friend channel;
+        };
+
+        /**
+         * Returns an awaiter that moves `value` into the channel, suspending only while the channel is full.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] send_awaiter send(T&& value) {
+            return send_awaiter{this, std::move(value)};
+        }
+        /**
+         * Returns an awaiter that takes the oldest value out of the channel, suspending only while it is empty.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] receive_awaiter receive() {
+            return receive_awaiter{this};
+        }
+        /**
+         * Closes the channel. Waiting senders fail, waiting receivers get `std::nullopt`,
+         * values that are still buffered can be received nonetheless.
+         */
+        void close() {
+            closed = true;
+            while(auto* s = senders.pop_front()) {
+                wake(s->handle, nullptr);
+            }
+            while(auto* r = receivers.pop_front()) {
+                wake(r->handle, nullptr);
+            }
+        }
+
+        std::size_t size() const {
+            return count;
+        }
+        static constexpr std::size_t capacity() {
+            return N;
+        }
+        bool is_closed() const {
+            return closed;
+        }
+    private:
+        static constexpr std::size_t slots = N > 0 ? N : 1;
+
+        alignas(T) std::byte storage[slots][sizeof(T)];
+        std::size_t head = 0;
+        std::size_t count = 0;
+        bool closed = false;
+        list<send_awaiter> senders{};
+        list<receive_awaiter> receivers{};
+
+        T* slot(std::size_t i) {
+            return std::launder(reinterpret_cast<T*>(storage[i]));
+        }
+        void push(T&& value) {
+            new(storage[(head + count) % slots]) T(std::move(value));
+            count++;
+        }
+        T pop() {
+            T* s = slot(head);
+            T value = std::move(*s);
+            s->~T();
+            head = (head + 1) % slots;
+            count--;
+            return value;
+        }
+        /**
+         * Resumes `waiter` right away, on behalf of `current` (which continues afterwards).
+         */
+        static void wake(std::coroutine_handle<> waiter, std::coroutine_handle<> current) {
+            auto loop = get_event_loop(waiter);
+            if(!loop) {
+                panic("Event loop is null");
+            }
+            auto previous = current ? current : loop->current_coroutine;
+            loop->resume(waiter);
+            loop->current_coroutine = previous;
+        }
+};
+
+}
@@ -1,35 +1,116 @@
 #pragma once
 
+#include <drivers/timer.hpp>
 #include <kernel/debug.hpp>
 #include <kernel/memory.hpp>
+#include <lib/list.hpp>
 
 #include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <source_location>
 #include <type_traits>
+#include <utility>
 
 namespace kernel {
 
 namespace events {
     class event_loop;
 }
+class cancellation_token;
 
 template<typename Return>
 struct promise;
 
+/**
+ * What a coroutine is doing, as recorded by the coroutine registry.
+ */
+enum class coroutine_state : uint8_t {
+    created,
+    running,
+    /** Queued on the ready queue of an event loop, see `events::yield`. */
+    ready,
+    sleeping,
+    waiting_event,
+    waiting_subscription,
+    /** Awaiting another coroutine or the next value of a generator. */
+    waiting_coroutine,
+    /** Awaiting a `task_group` or `when_all`/`when_any`. */
+    waiting_children,
+    waiting_channel,
+    /** Waiting for an `async_mutex`, `async_semaphore` or `async_condition_variable`. */
+    waiting_lock,
+    waiting_offload,
+    /** Suspended by an awaiter that does not tell what it waits for. */
+    suspended,
+};
+void kprint_value(ostream& out, const char*& format, coroutine_state value);
+
+namespace detail {
+    /**
+     * Entry of a coroutine frame in the coroutine registry, see `coroutine_snapshots`.
+     */
+    struct coroutine_record : list_mixin<coroutine_record> {
+        coroutine_state state = coroutine_state::created;
+        /** The event type for `waiting_event` and `waiting_subscription`. */
+        uint8_t waiting_on = 0;
+        /** How often an event loop resumed the coroutine. */
+        uint32_t resumes = 0;
+        /** Lower 32 bits of the system timer when the coroutine last suspended, in microseconds. */
+        uint32_t suspended_at = 0;
+        /** Cycles spent resuming the coroutine from its event loop, including everything it resumed in turn. */
+        uint64_t cycles = 0;
+
+        void set_state(coroutine_state state, uint8_t waiting_on = 0) {
+            this->state = state;
+            this->waiting_on = waiting_on;
+            if(state != coroutine_state::running) {
+                suspended_at = static_cast<uint32_t>(driver::timer::now());
+            }
+        }
+    };
+}
+
 template<typename Return>
 struct coroutine : std::coroutine_handle<promise<Return>>
 {
     using promise_type = promise<Return>;
 
-    ~coroutine() {
-        if(this->done() && this->promise().parent) { // top level coroutines have been cleaned up already by their final awaiter
-            this->destroy();
+    coroutine() = default;
+    coroutine(std::coroutine_handle<promise<Return>> handle) : std::coroutine_handle<promise<Return>>(handle) {}
+    coroutine(std::nullptr_t) : std::coroutine_handle<promise<Return>>(nullptr) {}
+    /**
+     * Coroutines are move-only: whoever takes over a frame (a caller, a `task_group`, a `cancel_scope`)
+     * leaves the source null, so its destructor never looks at a frame that is destroyed elsewhere.
+     */
+    coroutine(const coroutine&) = delete;
+    coroutine& operator=(const coroutine&) = delete;
+    coroutine(coroutine&& other) noexcept : std::coroutine_handle<promise<Return>>(std::exchange(other.handle(), nullptr)) {}
+    coroutine& operator=(coroutine&& other) noexcept {
+        if(this != &other) {
+            reset();
+            handle() = std::exchange(other.handle(), nullptr);
         }
+        return *this;
+    }
+
+    /**
+     * Gives up ownership of the frame, which is no longer destroyed by this object.
+     */
+    std::coroutine_handle<promise<Return>> release() {
+        return std::exchange(handle(), nullptr);
+    }
+
+    ~coroutine() {
+        reset();
     }
 
     template <typename T>
     [[nodiscard]] std::coroutine_handle<> await_suspend(std::coroutine_handle<T> caller) noexcept {
         debug::ktrace("Coroutine {} called by coroutine {}", get_coroutine_info(*this), get_coroutine_info(caller));
         this->promise().parent = caller;
+        set_coroutine_state(caller, coroutine_state::waiting_coroutine);
+        set_coroutine_state(*this, coroutine_state::running);
 
         // if possible, move new coroutine to the event loop of the caller
         auto loop = this->promise().event_loop = get_event_loop(caller);
@@ -47,13 +128,40 @@ struct coroutine : std::coroutine_handle<promise<Return>>
         debug::ktrace("Resuming await from coroutine {}", get_coroutine_info(*this));
         if constexpr (std::is_same_v<Return, void>) {
             return;
+        } else {
+            return this->promise().result;
+        }
+    }
+private:
+    std::coroutine_handle<promise<Return>>& handle() {
+        return *this;
+    }
+    void reset() {
+        // Top level coroutines have been cleaned up already by their final awaiter.
+        // An awaited coroutine that is not done yet belongs to a caller that is being destroyed
+        // while waiting for it (e.g. a cancelled `when_any` child), so it is destroyed as well.
+        if(*this && this->promise().parent) {
+            this->destroy();
         }
-        return this->promise().result;
     }
 };
 
 namespace detail {
     struct promise_base_base;
+
+    /**
+     * Lets the owner of a coroutine running concurrently to its caller decide what happens once it finishes,
+     * instead of resuming a parent, see `task_group`.
+     * `on_complete` returns the coroutine to continue with and may destroy the finished one.
+     */
+    struct completion {
+        using function = std::add_pointer_t<std::coroutine_handle<>(completion* self, std::coroutine_handle<> finished)>;
+        function on_complete;
+        /** The coroutine that started the child, to look up cancellation tokens further up. */
+        std::coroutine_handle<> owner{nullptr};
+        /** Set if the owner cancels the child when this token is cancelled, see `cancellable`. */
+        cancellation_token* token{nullptr};
+    };
 }
 class coroutine_info {
     public:
@@ -71,14 +179,26 @@ class coroutine_info {
         std::source_location m_location;
         void* m_address = nullptr;
 
-        std::source_location&& move_location() { return std::move(m_location); }
         friend struct detail::promise_base_base;
 };
 using coroutine_name = coroutine_info&&;
 
-inline const coroutine_info& get_coroutine_info(std::coroutine_handle<> handle);
+/**
+ * Name and creation site of a coroutine, shared by all frames created there.
+ */
+struct coroutine_descriptor {
+    const char* name;
+    std::source_location location;
+};
+
+inline coroutine_info get_coroutine_info(std::coroutine_handle<> handle);
 inline events::event_loop* get_event_loop(std::coroutine_handle<> handle);
 inline void set_event_loop(std::coroutine_handle<> handle, events::event_loop* loop);
+/**
+ * Records what the (suspending) coroutine waits for in the coroutine registry.
+ * `waiting_on` is the event type for `waiting_event` and `waiting_subscription`.
+ */
+inline void set_coroutine_state(std::coroutine_handle<> handle, coroutine_state state, uint8_t waiting_on = 0);
 
 namespace detail {
     template <typename R>
@@ -88,7 +208,12 @@ namespace detail {
         }
 
         [[nodiscard]] std::coroutine_handle<> await_suspend(std::coroutine_handle<promise<R>> handle) const noexcept {
+            if(auto c = handle.promise().completion) {
+                debug::ktrace("Final await for coroutine {} going to its owner.", get_coroutine_info(handle));
+                return c->on_complete(c, handle);
+            }
             auto parent = handle.promise().parent;
+            auto loop = handle.promise().event_loop;
             if(parent)
                 debug::ktrace("Final await for coroutine {} going to coroutine {}.", get_coroutine_info(handle), get_coroutine_info(parent));
             else
@@ -102,7 +227,12 @@ namespace detail {
                 */
                 handle.destroy();
             }
-            handle.promise().event_loop->current_coroutine = parent;
+            if(loop) {
+                loop->current_coroutine = parent;
+            }
+            if(parent) {
+                set_coroutine_state(parent, coroutine_state::running);
+            }
             return parent ? parent : std::noop_coroutine();
         }
 
@@ -127,19 +257,63 @@ namespace detail {
         }
     }
 
-    struct promise_base_base {
-        std::coroutine_handle<> parent{nullptr};
+    /**
+     * Returns the descriptor for coroutines called `name` created at `location`, adding it if it is new.
+     * Descriptors are never removed, there is one per name and call site in the kernel.
+     */
+    const coroutine_descriptor* intern_coroutine_descriptor(const char* name, const std::source_location& location);
+
+    void register_coroutine(promise_base_base* promise);
+    void unregister_coroutine(promise_base_base* promise);
 
-        coroutine_info info;
+    /**
+     * Common part of all promises. Every frame is linked into the coroutine registry
+     * from its construction until it is destroyed.
+     */
+    struct promise_base_base : coroutine_record {
+        std::coroutine_handle<> parent{nullptr};
+        /** Set instead of `parent` for coroutines started by a `task_group` or `when_all`/`when_any`. */
+        detail::completion* completion{nullptr};
         events::event_loop* event_loop{nullptr};
 
-        promise_base_base(std::source_location&& location, const char*&& name = "unnamed coroutine") :
-            info(std::move(name), false, std::move(location)) {
-            info.m_address = std::coroutine_handle<promise_base_base>::from_promise(*this).address();
-            debug::ktrace("Created coroutine promise for coroutine {}.", info);
+        promise_base_base(std::source_location&& location, const char*&& name = "unnamed coroutine", bool critical = false) :
+            descriptor_and_flags(reinterpret_cast<std::uintptr_t>(intern_coroutine_descriptor(name, location)) | (critical ? critical_flag : 0)) {
+            debug::ktrace("Created coroutine promise for coroutine {}.", info());
+            register_coroutine(this);
+        }
+        promise_base_base(coroutine_info&& name) : promise_base_base(std::move(name.m_location), std::move(name.m_name), name.m_critical) {}
+        ~promise_base_base() {
+            unregister_coroutine(this);
+        }
+        promise_base_base(const promise_base_base&) = delete;
+        promise_base_base& operator=(const promise_base_base&) = delete;
+
+        const coroutine_descriptor* descriptor() const {
+            return reinterpret_cast<const coroutine_descriptor*>(descriptor_and_flags & ~flag_mask);
+        }
+        bool critical() const {
+            return descriptor_and_flags & critical_flag;
+        }
+        coroutine_info info() {
+            auto d = descriptor();
+            return coroutine_info{d->name, critical(), d->location, std::coroutine_handle<promise_base_base>::from_promise(*this).address()};
+        }
+
+        // frames of every coroutine type live on the kernel heap
+        void* operator new(std::size_t n) noexcept {
+            debug::ktrace("Allocating coroutine promise of size {}.", n);
+            if(void* mem = kernel::malloc(n))
+                return mem;
+            debug::kerror("Failed ot allocate memory for promise type of size {}.", n);
+            return nullptr;
         }
-        promise_base_base(coroutine_info&& name) : promise_base_base(std::move(name.move_location()), std::move(name.name())) {}
+    private:
+        // descriptors are word aligned, which leaves the lowest bits of their address for flags
+        static constexpr std::uintptr_t critical_flag = 1;
+        static constexpr std::uintptr_t flag_mask = alignof(coroutine_descriptor) - 1;
+        static_assert(critical_flag <= flag_mask);
 
+        std::uintptr_t descriptor_and_flags;
     };
 
     template<typename Return>
@@ -150,25 +324,16 @@ namespace detail {
         std::suspend_always initial_suspend() noexcept { return {}; }
         detail::final_awaiter<Return> final_suspend() noexcept { return {}; }
         void unhandled_exception() noexcept {}
-
-        void* operator new(std::size_t n) noexcept {
-            debug::ktrace("Allocating coroutine promise of size {}.", n);
-            if(void* mem = kernel::malloc(n))
-                return mem;
-            debug::kerror("Failed ot allocate memory for promise type of size {}.", n);
-            return nullptr;
-        }
     };
 
-    inline static const coroutine_info invalid_coroutine{"INVALID COROUTINE", false, std::source_location{}, nullptr};
 }
 
-inline const coroutine_info& get_coroutine_info(std::coroutine_handle<> handle) {
+inline coroutine_info get_coroutine_info(std::coroutine_handle<> handle) {
     if(!handle) {
-        return detail::invalid_coroutine;
+        return coroutine_info{"INVALID COROUTINE", false, std::source_location{}, nullptr};
     }
     auto h = std::coroutine_handle<detail::promise_base_base>::from_address(handle.address());
-    return h.promise().info;
+    return h.promise().info();
 }
 events::event_loop* get_event_loop(std::coroutine_handle<> handle) {
     if(!handle) {
@@ -185,6 +350,37 @@ void set_event_loop(std::coroutine_handle<> handle, events::event_loop* loop) {
     h.promise().event_loop = loop;
 }
 
+void set_coroutine_state(std::coroutine_handle<> handle, coroutine_state state, uint8_t waiting_on) {
+    if(!handle) {
+        return;
+    }
+    auto h = std::coroutine_handle<detail::promise_base_base>::from_address(handle.address());
+    h.promise().set_state(state, waiting_on);
+}
+
+/**
+ * A copy of the registry entry of a coroutine, see `coroutine_snapshots`.
+ */
+struct coroutine_snapshot {
+    coroutine_info info;
+    events::event_loop* event_loop;
+    coroutine_state state;
+    uint8_t waiting_on;
+    uint32_t resumes;
+    uint64_t cycles;
+    /** Microseconds since the coroutine last suspended, 0 while it is running. */
+    uint32_t suspended_for;
+};
+/**
+ * Returns the number of coroutine frames that currently exist.
+ */
+std::size_t coroutine_count();
+/**
+ * Copies the registry entries of up to `max` coroutines to `out`, oldest first.
+ * Returns how many were copied.
+ */
+std::size_t coroutine_snapshots(coroutine_snapshot* out, std::size_t max);
+
 template<typename Return>
 struct promise : detail::promise_base<Return>
 {
@@ -201,7 +397,7 @@ struct promise : detail::promise_base<Return>
 
     void return_value(Return&& ret) {
         result = std::move(ret);
-        debug::ktrace("Coroutine {} returned a value.", this->info);
+        debug::ktrace("Coroutine {} returned a value.", this->info());
     }
 
     [[nodiscard]] coroutine<Return> get_return_object() {
@@ -224,7 +420,7 @@ struct promise<void> : detail::promise_base<void> {
         : detail::promise_base<void>(std::move(loc)) {}
 
     void return_void() {
-        debug::ktrace("Coroutine {} returned void.", this->info);
+        debug::ktrace("Coroutine {} returned void.", this->info());
     }
 
     [[nodiscard]] coroutine<void> get_return_object() {
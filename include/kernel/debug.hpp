@@ -8,6 +8,7 @@
 
 namespace kernel::debug {
     extern ostream* debug_stream;
+    extern ostream* log_stream;
 
     template<typename... Args>
     inline void kprint(const char* format, Args... args) {
@@ -56,16 +57,16 @@ namespace kernel::debug {
             return;
         }
         if constexpr (config::log_print_function) {
-            kprint("[{}{:<5}\033[0m] (\033[0;90m{}:{:<3} in \"{}\"\033[0m): ",
+            kernel::kprint(*log_stream, "[{}{:<5}\033[0m] (\033[0;90m{}:{:<3} in \"{}\"\033[0m): ",
                 log_level_color(level), log_level_name(level),
                 format.loc.file_name(), static_cast<int>(format.loc.line()), format.loc.function_name());
         }
         else {
-            kprint("[{}{:<5}\033[0m] (\033[0;90m{}:{:<3}\033[0m): ",
+            kernel::kprint(*log_stream, "[{}{:<5}\033[0m] (\033[0;90m{}:{:<3}\033[0m): ",
                 log_level_color(level), log_level_name(level),
                 format.loc.file_name(), static_cast<int>(format.loc.line()));
         }
-        kprintln(format.value, args...);
+        kernel::kprintln(*log_stream, format.value, args...);
     }
 
     template<typename... Args>
@@ -1,21 +1,35 @@
 #pragma once
 
+#include <atomic>
 #include <coroutine>
 #include <cstdint>
+#include <iterator>
+#include <span>
 #include <type_traits>
+#include <utility>
 
+#include <arch/arm/cpu.hpp>
 #include <arch/arm/interrupts.hpp>
+#include <config.hpp>
+#include <drivers/timer.hpp>
 #include <kernel/debug.hpp>
 #include <kernel/basic.hpp>
 #include <kernel/coroutine.hpp>
-#include <lib/queue.hpp>
+#include <kernel/instrumentation.hpp>
+#include <kernel/memory.hpp>
+#include <kernel/timers.hpp>
+#include <lib/list.hpp>
+#include <lib/ring_buffer.hpp>
 
 namespace kernel::events {
 
 enum class type {
+    /** Fired every `config::event_loop_tick_interval` microseconds, the data is the number of the tick. */
     tick,
     serial_rx,
     system_timer,
+    /** Not used by the kernel itself, free for tests and benchmarks. */
+    user,
     EVENT_TYPE_COUNT
 };
 
@@ -24,8 +38,49 @@ struct event {
     uint32_t data;
 };
 
+/**
+ * Priority classes of events, every class has its own queue.
+ */
+enum class priority {
+    high,
+    normal,
+    low,
+    PRIORITY_COUNT
+};
+constexpr std::size_t priority_count = static_cast<std::size_t>(priority::PRIORITY_COUNT);
+static_assert(std::size(config::event_priority_weights) == priority_count);
+
+/**
+ * The priority class events of type `t` are queued with unless a priority is given explicitly.
+ */
+constexpr priority default_priority(type t) {
+    switch(t) {
+        case type::tick:
+        case type::system_timer:
+            return priority::high;
+        case type::serial_rx:
+            return priority::normal;
+        default:
+            return priority::low;
+    }
+}
+
+/**
+ * A unit of work handed to an event loop with `event_loop::post`, which calls `func(work, userdata)` on the loop.
+ * Intrusive, so work can be posted without allocating as long as the node lives until it has run.
+ */
+struct posted_work {
+    using function = std::add_pointer_t<void(posted_work&, void*)>;
+
+    function func = nullptr;
+    void* userdata = nullptr;
+    posted_work* next = nullptr;
+};
+
 class awaiter;
 class yield;
+class handler;
+class basic_subscription;
 namespace detail {
     cpu::interrupts::interrupt_result process_interrupt(cpu::interrupts::interrupt_context&, void*);
 }
@@ -33,6 +88,40 @@ namespace detail {
 void configure();
 void run_main_event_loop();
 
+struct event_class_statistics {
+    std::size_t queue_depth{};
+    std::size_t queue_high_water{};
+    std::size_t queue_overruns{};
+    std::size_t events_processed{};
+    /** Time from firing an event until it is dispatched to its awaiters, in cycles. */
+    uint32_t latency_max{};
+    /** Moving average over roughly the last 16 events. */
+    uint32_t latency_average{};
+};
+
+/**
+ * Queue statistics are summed up over all priority classes, except for the high water mark,
+ * which is the highest one of any class.
+ */
+struct event_loop_statistics {
+    std::size_t queue_depth{};
+    std::size_t queue_high_water{};
+    std::size_t queue_overruns{};
+    std::size_t events_processed{};
+    std::size_t yields_processed{};
+    /** Number of functions run after being posted from other threads. */
+    std::size_t posts_processed{};
+    /** Number of coroutines ready to be resumed after a yield. */
+    std::size_t ready_queue_length{};
+    std::size_t ready_queue_high_water{};
+    std::size_t steps{};
+    /** Number of steps that ended because the budget was used up and not because the queues were empty. */
+    std::size_t budget_exhausted{};
+    /** Number of times the event loop blocked its thread because it had nothing to do. */
+    std::size_t parks{};
+    event_class_statistics classes[priority_count]{};
+};
+
 class event_loop {
     public:
         constexpr event_loop() = default;
@@ -40,10 +129,60 @@ class event_loop {
         [[noreturn]] void operator()() {
             run();
         }
+        /**
+         * Runs the event loop forever.
+         * Whenever there are no queued events or yields left, the thread running the loop is parked
+         * until an event is fired, a coroutine is moved to this loop or the next timer is due.
+         */
         [[noreturn]] void run();
         void step();
 
-        void fire_event(event&& event);
+        /**
+         * Queues an event for this event loop with the default priority of its type.
+         *
+         * Every event queue is a lock-free single-producer ring, so events must only be fired
+         * from one context at a time, which is interrupt context for the main event loop.
+         * If the queue is full, the event is dropped and counted as an overrun.
+         */
+        void fire_event(event&& event) {
+            fire_event(std::move(event), default_priority(event.type));
+        }
+        void fire_event(event&& event, priority p);
+        /**
+         * Queues multiple events at once, see `fire_event`.
+         */
+        void fire_events(std::span<const event> events);
+        void fire_events(std::span<const event> events, priority p);
+        /**
+         * Dispatches an event right away, without going through the event queue.
+         * Must only be called from the thread running this event loop.
+         */
+        void dispatch(const event& event);
+
+        /**
+         * Runs `work` on this event loop at the start of its next step.
+         *
+         * Unlike everything else, this may be called from any thread: posted work is pushed onto
+         * a lock-free multi-producer queue, and the loop is woken up if it is parked.
+         * Must not be called from interrupt handlers.
+         */
+        void post(posted_work* work);
+        /**
+         * Runs `func()` on this event loop at the start of its next step, see `post(posted_work*)`.
+         * The callable is moved into a node allocated with `kernel::malloc`.
+         * Returns `false` if the allocation failed.
+         */
+        template<typename Func>
+        bool post(Func&& func);
+        /**
+         * Removes `work` if it was posted but has not run yet, returns `false` otherwise.
+         * Must only be called from the thread running this event loop.
+         */
+        bool cancel_post(posted_work* work);
+        /**
+         * Returns `true` if the calling thread is the one running this event loop.
+         */
+        bool is_current() const;
 
         /**
         * Submits a coroutine to the event loop.
@@ -51,47 +190,231 @@ class event_loop {
         * This function may resume the coroutine up until the first co_await.
         */
         template<typename T>
-        bool submit_coroutine(coroutine<T>&& coro) {
-            if(!coro) {
-                debug::kerror("Tried to submit an empty coroutine to the event loop: {}", coro.address());
+        bool submit_coroutine(coroutine<T>&& child) {
+            if(!child) {
+                debug::kerror("Tried to submit an empty coroutine to the event loop: {}", child.address());
                 return false;
             }
+            // from now on the frame belongs to the loop, it is freed by the final awaiter of the coroutine
+            auto coro = child.release();
 
-            current_coroutine = coro;
             set_event_loop(coro, this);
 
-            coro.resume();
+            resume(coro);
             if(coro.done()) {
                 debug::kwarn("Coroutine {} done after first resume", get_coroutine_info(coro));
             }
             return true;
         }
-        std::coroutine_handle<> current_coroutine = nullptr;
-    private:
-        unsigned int counter = 0;
+        /**
+         * Calls `func` for every subscription registered on this event loop.
+         */
+        template<typename Func>
+        void for_each_subscription(Func&& func) const;
+        /**
+         * Calls `func` for every handler registered on this event loop.
+         */
+        template<typename Func>
+        void for_each_handler(Func&& func) const;
 
-        awaiter* event_awaiters[static_cast<uint32_t>(type::EVENT_TYPE_COUNT)]{};
-        queue<yield> yield_queue{};
+        /**
+         * Arms `timer` to fire at `deadline` (in microseconds of the system timer) on this event loop.
+         * Must only be called from the thread running this event loop.
+         */
+        void add_timer(timers::timer* timer, uint64_t deadline);
 
-        event event_queue[config::event_queue_size]{};
-        std::size_t read_pos = 0;
-        std::size_t write_pos = 0;
+        /**
+         * Resumes a coroutine waiting on this event loop.
+         * The time until it suspends again is accounted to its registry entry, including everything it resumes in turn,
+         * and with `config::event_loop_instrumentation` also to the statistics of all coroutines of its name.
+         */
+        void resume(std::coroutine_handle<> handle) {
+            current_coroutine = handle;
+            auto& record = std::coroutine_handle<kernel::detail::promise_base_base>::from_address(handle.address()).promise();
+            record.set_state(coroutine_state::running);
+            record.resumes++;
+            // the frame might be gone once the coroutine suspends, its destructor clears `resumed_record` then
+            auto outer = std::exchange(resumed_record, &record);
+            uint32_t start = cpu::cycle_counter();
+            if constexpr(config::event_loop_instrumentation) {
+                instrumentation::coroutine_key key{get_coroutine_info(handle)};
+                handle.resume();
+                runtimes.record(key, cpu::cycle_counter() - start);
+            } else {
+                handle.resume();
+            }
+            if(resumed_record) {
+                resumed_record->cycles += cpu::cycle_counter() - start;
+                if(resumed_record->state == coroutine_state::running) {
+                    resumed_record->set_state(coroutine_state::suspended);
+                }
+            }
+            resumed_record = outer;
+        }
+        /**
+         * Stops accounting run time to `record`, because its frame is destroyed or moves to another event loop.
+         */
+        void forget_record(kernel::detail::coroutine_record* record) {
+            if(resumed_record == record) {
+                resumed_record = nullptr;
+            }
+        }
+
+        event_loop_statistics statistics() const;
+        /**
+         * Resets latencies, histograms, run times, overruns and high water marks.
+         */
+        void reset_statistics();
+        const instrumentation::latency_histogram& latency_histogram(type t) const {
+            return histograms[static_cast<std::size_t>(t)];
+        }
+        const instrumentation::runtime_table& coroutine_runtimes() const {
+            return runtimes;
+        }
+        timers::timer_statistics timer_statistics() const {
+            return timer_wheel.statistics();
+        }
 
+        std::coroutine_handle<> current_coroutine = nullptr;
+    private:
+        /** Registry entry of the coroutine currently resumed by `resume`. */
+        kernel::detail::coroutine_record* resumed_record = nullptr;
+        unsigned int counter = 0;
+        uint32_t ticks = 0;
+        timers::timer tick_timer{&event_loop::fire_tick, this};
+
+        list<awaiter> event_awaiters[static_cast<uint32_t>(type::EVENT_TYPE_COUNT)]{};
+        list<handler> handlers[static_cast<uint32_t>(type::EVENT_TYPE_COUNT)]{};
+        basic_subscription* subscriptions[static_cast<uint32_t>(type::EVENT_TYPE_COUNT)]{};
+        list<yield> ready_queue{};
+        std::size_t ready_queue_high_water = 0;
+        /** The coroutine currently resumed from the ready queue and how often in a row. */
+        std::coroutine_handle<> ready_running = nullptr;
+        uint32_t ready_runs = 0;
+        timers::timing_wheel timer_wheel{};
+
+        struct queued_event {
+            struct event event;
+            /** Cycle counter when the event was fired, if instrumentation is enabled. */
+            uint32_t fired_at;
+            enum priority priority;
+        };
+        ring_buffer<queued_event, config::event_queue_size> event_queues[priority_count]{};
+        // only written by the producer of the event queues
+        volatile std::size_t queue_high_water[priority_count]{};
+        volatile std::size_t queue_overruns[priority_count]{};
+
+        struct class_latency {
+            std::size_t events_processed = 0;
+            uint32_t max = 0;
+            /** Scaled by 16, see `record_latency` */
+            uint32_t average = 0;
+        } latency[priority_count]{};
+        instrumentation::latency_histogram histograms[static_cast<std::size_t>(type::EVENT_TYPE_COUNT)]{};
+        instrumentation::runtime_table runtimes{};
+
+        std::size_t events_processed = 0;
+        std::size_t yields_processed = 0;
+        std::size_t posts_processed = 0;
+        std::size_t budget_exhausted = 0;
+        std::size_t parks = 0;
+
+        /** Work posted from other threads, newest first. */
+        std::atomic<posted_work*> posted{nullptr};
+        /** Posted work taken off `posted` and not run yet, in the order it was posted. */
+        posted_work* running_posted = nullptr;
+        /** The thread that last stepped this loop, see `threads::current`. */
+        const void* thread = nullptr;
+
+        /** Incremented whenever work is posted to this loop from another context, the loop thread parks on it. */
+        volatile uint32_t wake_sequence = 0;
+        volatile bool parked = false;
+
+        bool idle();
+        void park(uint32_t sequence);
+        static void fire_tick(timers::timer&, void* loop);
+
+        void run_posted();
         void process_events();
+        std::size_t take_events(std::span<queued_event> batch);
+        void dispatch_event(const event& e);
+        void record_enqueue(priority p, std::size_t requested, std::size_t queued);
+        void record_latency(priority p, uint32_t latency);
 
-        [[nodiscard("Use the return value to build a linked list")]] class awaiter* register_event_handler(type type, awaiter* awaiter);
+        void register_awaiter(awaiter* awaiter);
+        /** Must only be called from the thread running this event loop, other threads go through `post`. */
         void yield_coroutine(yield* awaiter);
 
+        void add_subscription(basic_subscription* subscription);
+        void remove_subscription(basic_subscription* subscription);
+        void deliver_to_subscriptions(const event& e);
+
         friend class awaiter;
         friend class yield;
+        friend class handler;
+        friend class basic_subscription;
 };
 inline constinit event_loop main_event_loop{};
 
-class awaiter {
+template<typename Func>
+bool event_loop::post(Func&& func) {
+    struct node {
+        posted_work work;
+        std::decay_t<Func> func;
+    };
+    void* memory = kernel::malloc(sizeof(node));
+    if(!memory) {
+        debug::kerror("Failed to allocate memory for posted work of size {}.", sizeof(node));
+        return false;
+    }
+    auto* n = new(memory) node{{}, std::forward<Func>(func)};
+    n->work.func = [](posted_work&, void* userdata) {
+        auto* n = static_cast<node*>(userdata);
+        n->func();
+        n->~node();
+        kernel::free(n);
+    };
+    n->work.userdata = n;
+    post(&n->work);
+    return true;
+}
+
+/**
+ * Predicates to filter events by their data, for use with `awaiter`.
+ */
+namespace filter {
+    constexpr bool equal(uint32_t data, uint32_t argument) {
+        return data == argument;
+    }
+    constexpr bool not_equal(uint32_t data, uint32_t argument) {
+        return data != argument;
+    }
+    constexpr bool greater_equal(uint32_t data, uint32_t argument) {
+        return data >= argument;
+    }
+    constexpr bool less(uint32_t data, uint32_t argument) {
+        return data < argument;
+    }
+    /**
+     * Like `greater_equal`, but correct across a wrap-around of `data` (e.g. for timer values).
+     */
+    constexpr bool reached(uint32_t data, uint32_t argument) {
+        return static_cast<int32_t>(data - argument) >= 0;
+    }
+    constexpr bool bits_set(uint32_t data, uint32_t argument) {
+        return (data & argument) == argument;
+    }
+}
+
+class awaiter : public list_mixin<awaiter> {
+public:
+    using predicate = std::add_pointer_t<bool(uint32_t data, uint32_t argument)>;
+private:
     type type_;
+    predicate filter = nullptr;
+    uint32_t argument{};
     uint32_t result{};
     std::coroutine_handle<> handle = nullptr;
-    awaiter* next = nullptr;
 
 public:
     /**
@@ -99,6 +422,17 @@ public:
      */
     awaiter(type type_) : type_(type_) {
     }
+    /**
+     * Constructs an awaiter to wait for an event of a specified type,
+     * whose data satisfies `filter(data, argument)`, e.g. `awaiter(type::serial_rx, filter::equal, '\r')`.
+     * Events not matching the filter do not resume the waiting coroutine.
+     */
+    awaiter(type type_, predicate filter, uint32_t argument) : type_(type_), filter(filter), argument(argument) {
+    }
+    ~awaiter() {
+        // the coroutine frame might be destroyed while waiting
+        unlink();
+    }
 
     [[nodiscard]] bool await_ready() const noexcept {
         return false;
@@ -106,14 +440,15 @@ public:
 
     bool await_suspend(std::coroutine_handle<> handle) noexcept {
         auto loop = get_event_loop(handle);
-        debug::ktrace("Coroutine {} is waiting for event {} on event loop {}, with next = {}",
-            get_coroutine_info(handle), static_cast<std::underlying_type_t<type>>(type_), loop, static_cast<void*>(next));
+        debug::ktrace("Coroutine {} is waiting for event {} on event loop {}",
+            get_coroutine_info(handle), static_cast<std::underlying_type_t<type>>(type_), loop);
         if(!loop) {
             panic("Event loop is null");
         }
 
         this->handle = handle;
-        this->next = loop->register_event_handler(type_, this);
+        set_coroutine_state(handle, coroutine_state::waiting_event, static_cast<uint8_t>(type_));
+        loop->register_awaiter(this);
         loop->current_coroutine = nullptr;
         return true;
     }
@@ -122,12 +457,10 @@ public:
         return result;
     }
 private:
+    bool matches(uint32_t data) const {
+        return !filter || filter(data, argument);
+    }
     void complete(uint32_t result) {
-        if(this->next) {
-            debug::ktrace("Forwarding event to next = {} before completing this = {}",
-                static_cast<void*>(next), static_cast<void*>(this));
-            this->next->complete(result);
-        }
         this->result = result;
         debug::ktrace("Resuming coroutine {} after event {} with result {}",
             get_coroutine_info(this->handle), static_cast<std::underlying_type_t<type>>(type_), result);
@@ -136,18 +469,37 @@ private:
         if(!loop) {
             panic("Event loop is null");
         }
-        loop->current_coroutine = this->handle;
-        this->handle.resume();
+        loop->resume(this->handle);
     }
     friend class event_loop;
 };
 
-class yield : public queue_mixin<yield> {
+/**
+ * Suspends the coroutine and queues it on the ready queue of its event loop, or of `target`, if given.
+ *
+ * The ready queue is served round-robin: a coroutine yielding again while it is resumed from the queue
+ * only runs again after every other coroutine that was ready before it had its turn.
+ * A `weight` greater than 1 lets a coroutine run up to `weight` times in a row per round.
+ */
+class yield : public list_mixin<yield> {
     std::coroutine_handle<> handle = nullptr;
     event_loop* target = nullptr;
+    /** Carries the yield over to a target loop running on another thread, see `hand_off`. */
+    posted_work handoff{};
+    event_loop* handoff_target = nullptr;
+    volatile bool handoff_pending = false;
+    uint32_t weight = 1;
+    bool continuation = false;
 public:
     yield() = default;
-    yield(event_loop* target) : target(target) {
+    yield(event_loop* target, uint32_t weight = 1) : target(target), weight(weight) {
+    }
+    ~yield() {
+        // the coroutine frame might be destroyed while waiting, which happens on the target loop like the hand-off
+        if(handoff_pending) {
+            handoff_target->cancel_post(&handoff);
+        }
+        unlink();
     }
 
     [[nodiscard]] bool await_ready() const noexcept {
@@ -163,35 +515,273 @@ public:
         }
 
         this->handle = handle;
-        target->yield_coroutine(this);
-        if(origin) {
-            origin->current_coroutine = nullptr;
+        set_coroutine_state(handle, coroutine_state::ready);
+        if(origin && origin != target) {
+            // the target might resume (and destroy) it before the origin is done with it
+            origin->forget_record(&std::coroutine_handle<kernel::detail::promise_base_base>::from_address(handle.address()).promise());
         }
         if(origin != target) {
             set_event_loop(handle, target);
         }
+        hand_off(target);
+        if(origin) {
+            origin->current_coroutine = nullptr;
+        }
         return true;
     }
 
     void await_resume() const noexcept {
         return;
     }
+
+    /**
+     * Queues `handle` on the ready queue of its own event loop, as if it had awaited this yield.
+     * Lets synchronization primitives resume a waiting coroutine from any event loop.
+     */
+    void schedule(std::coroutine_handle<> handle) {
+        this->handle = handle;
+        target = get_event_loop(handle);
+        if(!target) {
+            panic("Event loop is null");
+        }
+        set_coroutine_state(handle, coroutine_state::ready);
+        hand_off(target);
+    }
 private:
+    /**
+     * Queues this yield on `target`, directly if the calling thread runs it
+     * and through `event_loop::post` otherwise, as the ready queue belongs to the thread running the loop.
+     */
+    void hand_off(event_loop* target);
+
     void complete() {
         auto loop = get_event_loop(this->handle);
         debug::ktrace("Resuming coroutine {} after yield on event loop {}", get_coroutine_info(this->handle), loop);
         if(!loop) {
             panic("Event loop is null");
         }
-        loop->current_coroutine = this->handle;
-        this->handle.resume();
+        loop->resume(this->handle);
     }
-    friend struct yield_queue;
     friend class event_loop;
 };
 using yield_to = yield;
 using move_to_event_loop = yield;
 
+/**
+ * A `yield` on the current event loop with a weight, see `yield`.
+ */
+class weighted_yield : public yield {
+public:
+    weighted_yield(uint32_t weight) : yield(nullptr, weight) {
+    }
+};
+
+/**
+ * Suspends the coroutine until the system timer reaches `deadline` (in microseconds).
+ * The coroutine is resumed by the timing wheel of its event loop, at most one wheel tick late.
+ */
+class sleep_until : private timers::timer {
+    uint64_t until;
+    std::coroutine_handle<> handle = nullptr;
+public:
+    sleep_until(uint64_t deadline) : timer(&sleep_until::wake, this), until(deadline) {
+    }
+
+    [[nodiscard]] bool await_ready() const noexcept {
+        return driver::timer::now() >= until;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        auto loop = get_event_loop(handle);
+        debug::ktrace("Coroutine {} is sleeping until {} on event loop {}",
+            get_coroutine_info(handle), static_cast<uint32_t>(until), loop);
+        if(!loop) {
+            panic("Event loop is null");
+        }
+
+        this->handle = handle;
+        set_coroutine_state(handle, coroutine_state::sleeping);
+        loop->add_timer(this, until);
+        loop->current_coroutine = nullptr;
+        return true;
+    }
+
+    void await_resume() const noexcept {
+        return;
+    }
+private:
+    static void wake(timers::timer&, void* userdata) {
+        auto self = static_cast<sleep_until*>(userdata);
+        debug::ktrace("Resuming coroutine {} after sleeping until {}", get_coroutine_info(self->handle), static_cast<uint32_t>(self->until));
+
+        auto loop = get_event_loop(self->handle);
+        if(!loop) {
+            panic("Event loop is null");
+        }
+        loop->resume(self->handle);
+    }
+};
+
+/**
+ * Suspends the coroutine for `duration` microseconds, see `sleep_until`.
+ */
+class sleep_for : public sleep_until {
+public:
+    sleep_for(uint64_t duration) : sleep_until(driver::timer::now() + duration) {
+    }
+};
+
+/**
+ * A plain callback that is called with every event of one type as soon as it is dispatched,
+ * like `driver::timer::timer_func`. It runs inline on the event loop without suspending,
+ * resuming or allocating anything, which makes it the cheapest way to consume high-rate events.
+ * Subscriptions and coroutines waiting for the same events are served afterwards as usual.
+ *
+ * The callback must not register or unregister handlers itself.
+ */
+class handler : public list_mixin<handler> {
+    public:
+        using function = std::add_pointer_t<void(const event& e, void* userdata)>;
+
+        handler(event_loop& loop, type t, function func, void* userdata, const char* name = "unnamed handler");
+        ~handler();
+        handler(const handler&) = delete;
+        handler& operator=(const handler&) = delete;
+
+        const char* name() const { return m_name; }
+        type event_type() const { return m_type; }
+        std::size_t calls() const { return m_calls; }
+    private:
+        type m_type;
+        function func;
+        void* userdata;
+        const char* m_name;
+        std::size_t m_calls = 0;
+
+        friend class event_loop;
+};
+
+/**
+ * A subscription buffers every event of one type in its own bounded ring,
+ * so no event is lost while the subscribing coroutine is busy doing something else.
+ * Events arriving while the ring is full are dropped and counted.
+ *
+ * Use `subscription<N>` to create one with inline storage.
+ */
+class basic_subscription {
+    public:
+        basic_subscription(const basic_subscription&) = delete;
+        basic_subscription& operator=(const basic_subscription&) = delete;
+
+        class next_awaiter {
+            basic_subscription* subscription;
+            std::coroutine_handle<> handle = nullptr;
+        public:
+            next_awaiter(basic_subscription* subscription) : subscription(subscription) {}
+            ~next_awaiter() {
+                // the coroutine frame might be destroyed while waiting
+                if(handle && subscription->waiter == handle) {
+                    subscription->waiter = nullptr;
+                    subscription->resume_pending = false;
+                }
+            }
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return subscription->depth() > 0;
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                debug::ktrace("Coroutine {} is waiting for subscription \"{}\"", get_coroutine_info(handle), subscription->name());
+                if(subscription->waiter) {
+                    panic("Subscription already has a waiting coroutine");
+                }
+                subscription->waiter = this->handle = handle;
+                set_coroutine_state(handle, coroutine_state::waiting_subscription, static_cast<uint8_t>(subscription->event_type()));
+                if(auto loop = get_event_loop(handle)) {
+                    loop->current_coroutine = nullptr;
+                }
+                return true;
+            }
+            uint32_t await_resume() noexcept {
+                return subscription->pop();
+            }
+        };
+
+        /**
+         * Returns an awaiter that returns the next buffered event data,
+         * suspending only if the ring is empty.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] next_awaiter next() {
+            return next_awaiter{this};
+        }
+
+        const char* name() const { return m_name; }
+        type event_type() const { return m_type; }
+        std::size_t depth() const { return write_pos - read_pos; }
+        std::size_t capacity() const { return mask + 1; }
+        std::size_t high_water() const { return m_high_water; }
+        std::size_t delivered() const { return m_delivered; }
+        std::size_t dropped() const { return m_dropped; }
+    protected:
+        basic_subscription(event_loop& loop, type t, const char* name, uint32_t* buffer, std::size_t capacity);
+        ~basic_subscription();
+    private:
+        event_loop* loop;
+        type m_type;
+        const char* m_name;
+
+        uint32_t* buffer;
+        std::size_t mask;
+        std::size_t read_pos = 0;
+        std::size_t write_pos = 0;
+
+        std::size_t m_high_water = 0;
+        std::size_t m_delivered = 0;
+        std::size_t m_dropped = 0;
+
+        std::coroutine_handle<> waiter = nullptr;
+        bool resume_pending = false;
+        basic_subscription* next_subscription = nullptr;
+
+        void deliver(uint32_t data);
+        uint32_t pop() {
+            return buffer[read_pos++ & mask];
+        }
+
+        friend class event_loop;
+};
+
+template<std::size_t N>
+class subscription : public basic_subscription {
+    static_assert(N > 0 && (N & (N-1)) == 0, "Subscription capacity must be a power of two");
+    public:
+        subscription(event_loop& loop, type t, const char* name = "unnamed subscription")
+            : basic_subscription(loop, t, name, storage, N) {}
+    private:
+        uint32_t storage[N]{};
+};
+
+template<typename Func>
+void event_loop::for_each_handler(Func&& func) const {
+    for(const auto& l : handlers) {
+        for(auto* h = l.front(); h; h = list<handler>::next(h)) {
+            func(*h);
+        }
+    }
+}
+template<typename Func>
+void event_loop::for_each_subscription(Func&& func) const {
+    for(auto* head : subscriptions) {
+        for(auto* s = head; s; s = s->next_subscription) {
+            func(*s);
+        }
+    }
+}
+
+}
+
+namespace kernel {
+    void kprint_value(ostream& out, const char*& format, events::type value);
+    void kprint_value(ostream& out, const char*& format, events::priority value);
 }
 
 namespace kernel {
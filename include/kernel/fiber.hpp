@@ -0,0 +1,96 @@
+#pragma once
+
+#include <kernel/basic.hpp>
+
+#include <cstddef>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace kernel {
+
+/**
+ * Stack memory for a `fiber`, suitably aligned.
+ */
+template<std::size_t N>
+struct fiber_stack {
+    static_assert(N % 8 == 0, "Fiber stack size must be a multiple of 8");
+    alignas(8) std::byte memory[N];
+
+    operator std::span<std::byte>() {
+        return memory;
+    }
+};
+
+/**
+ * A cooperative fiber with a stack of its own, running on top of the kernel thread that resumes it.
+ *
+ * `resume` runs the fiber until it calls `yield` on itself or returns, and `yield` continues after the
+ * matching `resume`. Both only save and restore the callee-saved registers, stack pointer and return address
+ * in user mode, without trapping into the kernel, so blocking-style code that is too deep to be turned into
+ * coroutines can be suspended about as cheaply as a coroutine.
+ *
+ * The function is stored at the top of the stack, nothing is allocated. A fiber must only be resumed by one
+ * thread at a time and must have finished before it is destroyed, since objects on its stack are never unwound.
+ */
+class fiber {
+    public:
+        template<typename Func> requires std::is_invocable_v<Func&, fiber&>
+        fiber(std::span<std::byte> stack, Func&& func) {
+            using func_type = std::remove_cvref_t<Func>;
+            void* arg = prepare(stack, sizeof(func_type), alignof(func_type));
+            new(arg) func_type(std::forward<Func>(func));
+            this->arg = arg;
+            entry = [](fiber& self, void* arg) {
+                (*static_cast<func_type*>(arg))(self);
+            };
+            destroy = [](void* arg) {
+                static_cast<func_type*>(arg)->~func_type();
+            };
+        }
+        ~fiber() {
+            if(started && !finished) {
+                panic("Fiber destroyed while it is suspended");
+            }
+            destroy(arg);
+        }
+        fiber(const fiber&) = delete;
+        fiber& operator=(const fiber&) = delete;
+
+        /**
+         * Runs the fiber until it yields or returns.
+         * Returns `false` if it has returned, then it must not be resumed anymore.
+         */
+        bool resume();
+        /**
+         * Suspends the fiber and continues after the `resume` that ran it. Must only be called by the fiber itself.
+         */
+        void yield();
+
+        bool done() const {
+            return finished;
+        }
+    private:
+        using entry_point = std::add_pointer_t<void(fiber& self, void* arg)>;
+
+        /** Saved stack pointer of the fiber while it is suspended, its registers are stored on its stack. */
+        void* sp = nullptr;
+        /** Saved stack pointer of the thread (or fiber) that resumed it, while it is running. */
+        void* caller_sp = nullptr;
+        entry_point entry = nullptr;
+        void (*destroy)(void*) = nullptr;
+        void* arg = nullptr;
+        bool running = false;
+        bool started = false;
+        bool finished = false;
+
+        /**
+         * Reserves room for the function at the top of `stack` and sets up the first switch into the fiber.
+         * Returns where to construct the function.
+         */
+        void* prepare(std::span<std::byte> stack, std::size_t size, std::size_t alignment);
+        [[noreturn]] static void run(fiber* self);
+};
+
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+
+#include <coroutine>
+#include <cstddef>
+#include <iterator>
+#include <source_location>
+#include <utility>
+
+namespace kernel {
+
+namespace detail {
+    /**
+     * Common part of the promises of `generator` and `async_generator`.
+     * Yielded values are not copied, the promise only points to them while the generator is suspended.
+     */
+    template<typename T>
+    struct generator_promise_base : promise_base_base {
+        const T* value = nullptr;
+
+        template<typename... Args>
+        generator_promise_base(Args&&...args) requires(ContainsName<Args...>) :
+            promise_base_base(std::move(find_coroutine_name(args...))) {
+            static_assert(ContainsNameOnce<Args...>, "Coroutine has multiple names");
+        }
+        generator_promise_base(std::source_location&& loc = std::source_location::current())
+            : promise_base_base(std::move(loc)) {}
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {}
+    };
+}
+
+/**
+ * A lazy generator: the coroutine runs up to its next `co_yield` whenever the next value is requested,
+ * so values are produced one at a time instead of building the whole output first.
+ *
+ * Use it with a range-based for loop. Values are passed by reference to the yielded object,
+ * which is valid until the loop advances. A generator cannot `co_await`, see `async_generator` for that.
+ */
+template<typename T>
+class generator {
+    public:
+        struct promise_type : detail::generator_promise_base<T> {
+            using detail::generator_promise_base<T>::generator_promise_base;
+
+            [[nodiscard]] generator get_return_object() {
+                return generator{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+            static generator get_return_object_on_allocation_failure() {
+                return generator{nullptr};
+            }
+            std::suspend_always final_suspend() noexcept { return {}; }
+
+            std::suspend_always yield_value(const T& value) noexcept {
+                this->value = &value;
+                return {};
+            }
+            template<typename U>
+            void await_transform(U&&) = delete;
+        };
+
+        class iterator {
+            std::coroutine_handle<promise_type> handle = nullptr;
+        public:
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            explicit iterator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+            const T& operator*() const {
+                return *handle.promise().value;
+            }
+            const T* operator->() const {
+                return handle.promise().value;
+            }
+            iterator& operator++() {
+                handle.resume();
+                return *this;
+            }
+            void operator++(int) {
+                ++*this;
+            }
+            bool operator==(std::default_sentinel_t) const {
+                return !handle || handle.done();
+            }
+        };
+
+        generator(generator&& other) : handle(std::exchange(other.handle, nullptr)) {}
+        generator& operator=(generator&& other) {
+            std::swap(handle, other.handle);
+            return *this;
+        }
+        generator(const generator&) = delete;
+        generator& operator=(const generator&) = delete;
+        ~generator() {
+            if(handle) {
+                handle.destroy();
+            }
+        }
+
+        /**
+         * Runs the generator up to its first value. Must only be called once.
+         */
+        iterator begin() {
+            if(handle) {
+                handle.resume();
+            }
+            return iterator{handle};
+        }
+        std::default_sentinel_t end() const {
+            return {};
+        }
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit generator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+/**
+ * A lazy generator that may `co_await` between its values, e.g. to wait for events.
+ *
+ * `co_await gen.next()` runs the generator on the event loop of the awaiting coroutine up to its next `co_yield`
+ * and returns a pointer to the yielded value (valid until the next call), or `nullptr` once it has finished.
+ * Control passes between both coroutines directly, without a round-trip through the event loop.
+ * Destroying the generator cancels it, wherever it is waiting.
+ */
+template<typename T>
+class async_generator {
+    public:
+        struct promise_type;
+    private:
+        /** Passes control back to the coroutine waiting for the next value, which is stored as `parent`. */
+        struct return_to_consumer {
+            [[nodiscard]] bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+                auto consumer = std::exchange(handle.promise().parent, nullptr);
+                if(auto loop = handle.promise().event_loop) {
+                    loop->current_coroutine = consumer;
+                }
+                handle.promise().set_state(coroutine_state::suspended);
+                set_coroutine_state(consumer, coroutine_state::running);
+                return consumer;
+            }
+            void await_resume() const noexcept {}
+        };
+    public:
+        struct promise_type : detail::generator_promise_base<T> {
+            using detail::generator_promise_base<T>::generator_promise_base;
+
+            [[nodiscard]] async_generator get_return_object() {
+                return async_generator{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+            static async_generator get_return_object_on_allocation_failure() {
+                return async_generator{nullptr};
+            }
+            return_to_consumer final_suspend() noexcept {
+                this->value = nullptr;
+                return {};
+            }
+
+            return_to_consumer yield_value(const T& value) noexcept {
+                this->value = &value;
+                return {};
+            }
+        };
+
+        class next_awaiter {
+            std::coroutine_handle<promise_type> handle;
+        public:
+            explicit next_awaiter(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return !handle || handle.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+                debug::ktrace("Coroutine {} waits for the next value of generator {}", get_coroutine_info(consumer), get_coroutine_info(handle));
+                auto& promise = handle.promise();
+                promise.parent = consumer;
+                set_coroutine_state(consumer, coroutine_state::waiting_coroutine);
+                promise.set_state(coroutine_state::running);
+                // the generator runs wherever it is consumed
+                auto loop = promise.event_loop = get_event_loop(consumer);
+                if(loop) {
+                    loop->current_coroutine = handle;
+                }
+                return handle;
+            }
+            const T* await_resume() const noexcept {
+                return handle && !handle.done() ? handle.promise().value : nullptr;
+            }
+        };
+
+        async_generator(async_generator&& other) : handle(std::exchange(other.handle, nullptr)) {}
+        async_generator& operator=(async_generator&& other) {
+            std::swap(handle, other.handle);
+            return *this;
+        }
+        async_generator(const async_generator&) = delete;
+        async_generator& operator=(const async_generator&) = delete;
+        ~async_generator() {
+            if(handle) {
+                handle.destroy();
+            }
+        }
+
+        /**
+         * Returns an awaiter that produces the next value, see `async_generator`.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] next_awaiter next() {
+            return next_awaiter{handle};
+        }
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit async_generator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+}
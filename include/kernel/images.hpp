@@ -1,7 +1,16 @@
 #pragma once
 
+#include <kernel/generator.hpp>
+
+#include <string_view>
+
 namespace kernel::images {
 
 extern const char* keqingheart;
 
+/**
+ * Yields the lines of `image` one by one, without their line breaks.
+ */
+generator<std::string_view> lines(const char* image, coroutine_name = "image lines");
+
 }
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <config.hpp>
+#include <kernel/coroutine.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace kernel::instrumentation {
+
+/**
+ * Histogram with power of two buckets, bucket `i` counts values in [2^i, 2^(i+1)).
+ */
+class latency_histogram {
+    public:
+        static constexpr std::size_t buckets = 32;
+
+        void record(uint32_t value) {
+            counts[bucket(value)]++;
+            m_samples++;
+            m_max = std::max(m_max, value);
+        }
+        void reset() {
+            *this = {};
+        }
+
+        uint32_t count(std::size_t bucket) const { return counts[bucket]; }
+        std::size_t samples() const { return m_samples; }
+        uint32_t max() const { return m_max; }
+
+        static constexpr unsigned int bucket(uint32_t value) {
+            return 31 - __builtin_clz(value | 1);
+        }
+        static constexpr uint32_t lower_bound(std::size_t bucket) {
+            return bucket ? 1U << bucket : 0;
+        }
+    private:
+        uint32_t counts[buckets]{};
+        std::size_t m_samples = 0;
+        uint32_t m_max = 0;
+};
+
+/**
+ * Identifies a coroutine by its name and where it was created,
+ * so all instances of the same coroutine share their statistics.
+ */
+struct coroutine_key {
+    const char* name = nullptr;
+    const char* function = nullptr;
+    uint32_t line = 0;
+
+    coroutine_key() = default;
+    explicit coroutine_key(const coroutine_info& info)
+        : name(info.name()), function(info.location().function_name()), line(info.location().line()) {}
+
+    bool operator==(const coroutine_key&) const = default;
+};
+
+struct coroutine_runtime {
+    coroutine_key key{};
+    std::size_t resumes = 0;
+    /** Sum of all run times, in cycles. */
+    uint64_t cycles = 0;
+    uint32_t max = 0;
+};
+
+/**
+ * Fixed size open addressing table of run times per coroutine.
+ * Coroutines that do not fit anymore are only counted as untracked.
+ */
+class runtime_table {
+    static_assert((config::instrumentation_coroutine_slots & (config::instrumentation_coroutine_slots - 1)) == 0,
+        "Number of coroutine slots must be a power of two");
+    public:
+        void record(const coroutine_key& key, uint32_t cycles) {
+            constexpr std::size_t mask = config::instrumentation_coroutine_slots - 1;
+            std::size_t start = (reinterpret_cast<uintptr_t>(key.name) ^ key.line) & mask;
+            for(std::size_t i = 0; i <= mask; i++) {
+                auto& e = entries[(start + i) & mask];
+                if(!e.key.name) {
+                    e.key = key;
+                }
+                if(e.key == key) {
+                    e.resumes++;
+                    e.cycles += cycles;
+                    e.max = std::max(e.max, cycles);
+                    return;
+                }
+            }
+            m_untracked++;
+        }
+        void reset() {
+            *this = {};
+        }
+
+        template<typename Func>
+        void for_each(Func&& func) const {
+            for(const auto& e : entries) {
+                if(e.key.name) {
+                    func(e);
+                }
+            }
+        }
+        std::size_t untracked() const { return m_untracked; }
+    private:
+        coroutine_runtime entries[config::instrumentation_coroutine_slots]{};
+        std::size_t m_untracked = 0;
+};
+
+}
@@ -23,6 +23,19 @@ struct memory_statistics {
 };
 const memory_statistics& malloc_stats();
 
+struct memory_block {
+    const void* address;
+    std::size_t size;
+    bool used;
+};
+template<typename T>
+class generator;
+/**
+ * Walks all blocks of the heap in address order, see `generator`.
+ * Nothing must be allocated or freed while the walk is in progress.
+ */
+generator<memory_block> memory_blocks();
+
 void malloc_init();
 void* malloc(size_t size);
 void* calloc(size_t num, size_t size);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+#include <kernel/events.hpp>
+#include <kernel/task_group.hpp>
+#include <lib/list.hpp>
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace kernel {
+
+namespace detail {
+    /**
+     * Blocking work for the worker pool. `run` is called on a worker thread,
+     * which must hand the result back to the event loop of the waiting coroutine itself.
+     */
+    struct offload_task : list_mixin<offload_task> {
+        using function = std::add_pointer_t<void(offload_task&)>;
+        function run = nullptr;
+    };
+    void submit_offload(offload_task* task);
+}
+
+/**
+ * Starts the `config::offload_workers` worker threads. Must be called once, after `threads::init`.
+ */
+void start_offload_workers();
+
+struct offload_statistics {
+    std::size_t submitted{};
+    std::size_t completed{};
+    std::size_t queue_high_water{};
+};
+offload_statistics get_offload_statistics();
+
+/**
+ * Runs `func` on a worker thread and resumes the awaiting coroutine on its own event loop
+ * with the result once it has returned, see `offload`.
+ */
+template<typename Func>
+class offload_awaiter : detail::offload_task {
+    using result_type = std::invoke_result_t<Func&>;
+
+    Func func;
+    detail::result_t<result_type> result{};
+    std::coroutine_handle<> handle = nullptr;
+    events::event_loop* loop = nullptr;
+    events::posted_work done{};
+    volatile bool running = false;
+public:
+    explicit offload_awaiter(Func&& func) : func(std::move(func)) {}
+    offload_awaiter(const offload_awaiter&) = delete;
+    offload_awaiter& operator=(const offload_awaiter&) = delete;
+    ~offload_awaiter() {
+        if(running) {
+            // the worker thread still writes to this awaiter, it cannot be cancelled
+            panic("Coroutine destroyed while its offloaded work is running");
+        }
+    }
+
+    [[nodiscard]] bool await_ready() const noexcept {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        loop = get_event_loop(handle);
+        if(!loop) {
+            panic("Event loop is null");
+        }
+        this->handle = handle;
+        run = &offload_awaiter::execute;
+        done = {&offload_awaiter::finish, this};
+        running = true;
+        set_coroutine_state(handle, coroutine_state::waiting_offload);
+        loop->current_coroutine = nullptr;
+        detail::submit_offload(this);
+        return true;
+    }
+    auto await_resume() {
+        if constexpr(std::is_void_v<result_type>) {
+            return;
+        } else {
+            return std::move(result);
+        }
+    }
+private:
+    static void execute(offload_task& task) {
+        auto& self = static_cast<offload_awaiter&>(task);
+        if constexpr(std::is_void_v<result_type>) {
+            self.func();
+        } else {
+            self.result = self.func();
+        }
+        // the coroutine might be resumed and gone as soon as this is posted
+        self.loop->post(&self.done);
+    }
+    static void finish(events::posted_work&, void* userdata) {
+        auto* self = static_cast<offload_awaiter*>(userdata);
+        self->running = false;
+        self->loop->resume(self->handle);
+    }
+};
+
+/**
+ * Returns an awaiter that runs `func()` on one of the worker threads, so blocking or CPU heavy work
+ * does not stall the event loop, and returns its result. The awaiting coroutine is suspended meanwhile
+ * and resumed on its own event loop. Offloaded work cannot be cancelled.
+ */
+template<typename Func>
+[[nodiscard("The awaiter must be awaited.")]] auto offload(Func&& func) {
+    return offload_awaiter<std::decay_t<Func>>{std::decay_t<Func>(std::forward<Func>(func))};
+}
+
+}
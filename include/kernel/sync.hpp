@@ -0,0 +1,336 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+#include <kernel/events.hpp>
+#include <kernel/threads.hpp>
+#include <lib/list.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+namespace kernel {
+
+/**
+ * A mutex for threads.
+ *
+ * Locking an unlocked mutex and unlocking a mutex nobody waits for is a single atomic operation on one word.
+ * A thread finding it locked parks on that word, so it is descheduled until the owner unlocks the mutex
+ * and wakes exactly one waiter, whatever the priorities of both.
+ * Coroutines only use it to protect a few instructions, like the wait queues of the primitives below,
+ * since waiting for it blocks their whole event loop.
+ */
+class mutex {
+    public:
+        constexpr mutex() = default;
+        mutex(const mutex&) = delete;
+        mutex& operator=(const mutex&) = delete;
+
+        void lock() {
+            uint32_t expected = unlocked;
+            if(!std::atomic_ref(state).compare_exchange_strong(expected, locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+                lock_slow(expected);
+            }
+        }
+        bool try_lock() {
+            uint32_t expected = unlocked;
+            return std::atomic_ref(state).compare_exchange_strong(expected, locked, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+        void unlock() {
+            if(std::atomic_ref(state).exchange(unlocked, std::memory_order_release) == contended) {
+                threads::wake(&state, 1);
+            }
+        }
+    private:
+        enum : uint32_t {
+            unlocked,
+            locked,
+            /** Locked, and there might be parked threads, so unlocking has to wake one. */
+            contended,
+        };
+        alignas(std::atomic_ref<uint32_t>::required_alignment) uint32_t state = unlocked;
+
+        void lock_slow(uint32_t seen);
+
+        friend class condition_variable;
+};
+
+/**
+ * Locks a `mutex` for as long as it is in scope.
+ */
+class lock_guard {
+    mutex& m;
+public:
+    explicit lock_guard(mutex& m) : m(m) {
+        m.lock();
+    }
+    ~lock_guard() {
+        m.unlock();
+    }
+    lock_guard(const lock_guard&) = delete;
+    lock_guard& operator=(const lock_guard&) = delete;
+};
+
+class async_mutex;
+class async_condition_variable;
+
+/**
+ * Unlocks an `async_mutex` when it goes out of scope, see `async_mutex::scoped_lock`.
+ */
+class async_lock_guard {
+    async_mutex* mutex;
+public:
+    explicit async_lock_guard(async_mutex* mutex) : mutex(mutex) {}
+    async_lock_guard(async_lock_guard&& other) : mutex(std::exchange(other.mutex, nullptr)) {}
+    async_lock_guard& operator=(async_lock_guard&&) = delete;
+    inline ~async_lock_guard();
+};
+
+/**
+ * A mutex for coroutines, which may run on different event loops.
+ *
+ * Taking an unlocked mutex and unlocking a mutex nobody waits for is a single atomic compare-and-swap.
+ * Otherwise the coroutine is queued and suspended, and the mutex is handed over to the waiting
+ * coroutines in FIFO order, each of them resumed on its own event loop.
+ */
+class async_mutex {
+    public:
+        constexpr async_mutex() = default;
+        async_mutex(const async_mutex&) = delete;
+        async_mutex& operator=(const async_mutex&) = delete;
+
+        class lock_awaiter : public list_mixin<lock_awaiter> {
+        protected:
+            async_mutex* mutex;
+        private:
+            std::coroutine_handle<> handle = nullptr;
+            events::yield wakeup{};
+            bool acquired = false;
+            bool resumed = false;
+        public:
+            lock_awaiter(async_mutex* mutex) : mutex(mutex) {}
+            ~lock_awaiter();
+
+            [[nodiscard]] bool await_ready() noexcept {
+                return acquired = mutex->try_lock();
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                return mutex->lock_slow(this, handle);
+            }
+            void await_resume() noexcept {
+                resumed = true;
+            }
+            friend async_mutex;
+            friend async_condition_variable;
+        };
+        class scoped_lock_awaiter : public lock_awaiter {
+        public:
+            using lock_awaiter::lock_awaiter;
+            [[nodiscard]] async_lock_guard await_resume() noexcept {
+                lock_awaiter::await_resume();
+                return async_lock_guard{mutex};
+            }
+        };
+
+        /**
+         * Returns an awaiter that locks the mutex, suspending only while it is locked by someone else.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] lock_awaiter lock() {
+            return lock_awaiter{this};
+        }
+        /**
+         * Like `lock`, but returns a guard that unlocks the mutex when it goes out of scope.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] scoped_lock_awaiter scoped_lock() {
+            return scoped_lock_awaiter{this};
+        }
+        bool try_lock() {
+            uint32_t expected = unlocked;
+            return state.compare_exchange_strong(expected, locked, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+        /**
+         * Unlocks the mutex, or passes it on to the first waiting coroutine.
+         */
+        void unlock() {
+            uint32_t expected = locked;
+            if(!state.compare_exchange_strong(expected, unlocked, std::memory_order_release, std::memory_order_relaxed)) {
+                unlock_slow();
+            }
+        }
+        bool is_locked() const {
+            return state.load(std::memory_order_relaxed) != unlocked;
+        }
+    private:
+        enum : uint32_t {
+            unlocked,
+            locked,
+            /** Locked, and there might be waiting coroutines, so unlocking has to look at the queue. */
+            contended,
+        };
+        std::atomic<uint32_t> state{unlocked};
+        mutex guard{};
+        list<lock_awaiter> waiters{};
+
+        bool lock_slow(lock_awaiter* waiter, std::coroutine_handle<> handle);
+        void unlock_slow();
+        /**
+         * Locks the mutex on behalf of `handle` (which is suspended already) and resumes it once it got the lock.
+         */
+        void lock_for(lock_awaiter* waiter, std::coroutine_handle<> handle);
+
+        friend async_condition_variable;
+};
+
+async_lock_guard::~async_lock_guard() {
+    if(mutex) {
+        mutex->unlock();
+    }
+}
+
+/**
+ * A counting semaphore for coroutines, which may run on different event loops.
+ *
+ * Acquiring an available permit is an atomic compare-and-swap, otherwise the coroutine is queued and suspended.
+ * Released permits are handed to the waiting coroutines in FIFO order, each of them resumed on its own event loop.
+ */
+class async_semaphore {
+    public:
+        constexpr explicit async_semaphore(uint32_t permits) : permits(permits) {}
+        async_semaphore(const async_semaphore&) = delete;
+        async_semaphore& operator=(const async_semaphore&) = delete;
+
+        class acquire_awaiter : public list_mixin<acquire_awaiter> {
+            async_semaphore* semaphore;
+            std::coroutine_handle<> handle = nullptr;
+            events::yield wakeup{};
+            bool acquired = false;
+            bool resumed = false;
+        public:
+            acquire_awaiter(async_semaphore* semaphore) : semaphore(semaphore) {}
+            ~acquire_awaiter();
+
+            [[nodiscard]] bool await_ready() noexcept {
+                return acquired = semaphore->try_acquire();
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                return semaphore->acquire_slow(this, handle);
+            }
+            void await_resume() noexcept {
+                resumed = true;
+            }
+            friend async_semaphore;
+        };
+
+        /**
+         * Returns an awaiter that takes one permit, suspending only while none is available.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] acquire_awaiter acquire() {
+            return acquire_awaiter{this};
+        }
+        bool try_acquire() {
+            uint32_t available = permits.load(std::memory_order_relaxed);
+            while(available > 0) {
+                if(permits.compare_exchange_weak(available, available - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        /**
+         * Returns `count` permits, waking up as many waiting coroutines.
+         */
+        void release(uint32_t count = 1);
+
+        uint32_t available() const {
+            return permits.load(std::memory_order_relaxed);
+        }
+    private:
+        std::atomic<uint32_t> permits;
+        mutex guard{};
+        list<acquire_awaiter> waiters{};
+
+        bool acquire_slow(acquire_awaiter* waiter, std::coroutine_handle<> handle);
+};
+
+/**
+ * A condition variable for coroutines, used together with an `async_mutex`.
+ *
+ * Waiting unlocks the mutex and suspends the coroutine. A notified coroutine is queued on the mutex right away
+ * and resumed on its own event loop once it got the mutex back, so it never wakes up just to wait for the lock.
+ * As usual, the condition has to be checked again after waking up.
+ */
+class async_condition_variable {
+    public:
+        constexpr async_condition_variable() = default;
+        async_condition_variable(const async_condition_variable&) = delete;
+        async_condition_variable& operator=(const async_condition_variable&) = delete;
+
+        class wait_awaiter : public list_mixin<wait_awaiter> {
+            async_condition_variable* cv;
+            async_mutex::lock_awaiter relock;
+            std::coroutine_handle<> handle = nullptr;
+            bool resumed = false;
+        public:
+            wait_awaiter(async_condition_variable* cv, async_mutex* mutex) : cv(cv), relock(mutex) {}
+            ~wait_awaiter();
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return false;
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                cv->wait_slow(this, handle);
+                return true;
+            }
+            void await_resume() noexcept {
+                relock.await_resume();
+                resumed = true;
+            }
+            friend async_condition_variable;
+        };
+
+        /**
+         * Returns an awaiter that unlocks `mutex` (which has to be locked) and waits for a notification.
+         * The mutex is locked again when the awaiter returns.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] wait_awaiter wait(async_mutex& mutex) {
+            return wait_awaiter{this, &mutex};
+        }
+        void notify_one();
+        void notify_all();
+    private:
+        mutex guard{};
+        list<wait_awaiter> waiters{};
+
+        void wait_slow(wait_awaiter* waiter, std::coroutine_handle<> handle);
+};
+
+/**
+ * A condition variable for threads, used together with a `mutex`.
+ *
+ * Waiting threads park on a sequence number that every notification increments, so a notification
+ * between unlocking the mutex and parking is never lost. As usual, the condition has to be checked
+ * again after waking up.
+ */
+class condition_variable {
+    public:
+        constexpr condition_variable() = default;
+        condition_variable(const condition_variable&) = delete;
+        condition_variable& operator=(const condition_variable&) = delete;
+
+        /**
+         * Unlocks `m` (which has to be locked by the caller), waits for a notification and locks `m` again.
+         */
+        void wait(mutex& m);
+        template<typename Predicate>
+        void wait(mutex& m, Predicate pred) {
+            while(!pred()) {
+                wait(m);
+            }
+        }
+        void notify_one();
+        void notify_all();
+    private:
+        alignas(std::atomic_ref<uint32_t>::required_alignment) uint32_t sequence = 0;
+};
+
+}
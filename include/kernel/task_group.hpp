@@ -0,0 +1,299 @@
+#pragma once
+
+#include <kernel/coroutine.hpp>
+#include <kernel/events.hpp>
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace kernel {
+
+namespace detail {
+    template<typename T>
+    using result_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    /**
+     * Starts `child` on `loop` as a child of `owner`, running it up until its first co_await.
+     * The child may already be finished (and `owner` notified) when this returns.
+     */
+    inline void start_child(std::coroutine_handle<> child, completion* owner, events::event_loop* loop, std::coroutine_handle<> caller) {
+        auto h = std::coroutine_handle<promise_base_base>::from_address(child.address());
+        h.promise().completion = owner;
+        h.promise().event_loop = loop;
+        owner->owner = caller;
+        debug::ktrace("Coroutine {} started by coroutine {}", get_coroutine_info(child), get_coroutine_info(caller));
+        loop->resume(child);
+        loop->current_coroutine = caller;
+    }
+
+    /**
+     * Awaits a fixed set of children that are all started at once.
+     * With `any`, the caller is resumed as soon as the first child finishes and all others are cancelled,
+     * otherwise once every child has finished.
+     */
+    template<bool any, typename... T>
+    class when_awaiter : completion {
+        public:
+            explicit when_awaiter(coroutine<T>&&... children) : completion{&finished}, children{std::move(children)...} {}
+            when_awaiter(const when_awaiter&) = delete;
+            when_awaiter& operator=(const when_awaiter&) = delete;
+            ~when_awaiter() {
+                // children still running when the caller is destroyed are cancelled along with it
+                std::apply([](auto&... c) { (destroy(c), ...); }, children);
+            }
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return sizeof...(T) == 0;
+            }
+            bool await_suspend(std::coroutine_handle<> caller) noexcept {
+                loop = get_event_loop(caller);
+                if(!loop) {
+                    panic("Event loop is null");
+                }
+                waiter = caller;
+                starting = true;
+                std::apply([this, caller](auto&... c) { (start(c, caller), ...); }, children);
+                starting = false;
+                if(done()) {
+                    return false;
+                }
+                set_coroutine_state(caller, coroutine_state::waiting_children);
+                loop->current_coroutine = nullptr;
+                return true;
+            }
+            auto await_resume() {
+                if constexpr(any) {
+                    // cancel the losers right away, so they cannot take any more events
+                    std::size_t i = 0;
+                    std::apply([this, &i](auto&... c) { ((i++ != winner ? destroy(c) : void()), ...); }, children);
+                    return winner;
+                } else {
+                    return std::apply([](auto&... c) { return std::tuple<result_t<T>...>{result(c)...}; }, children);
+                }
+            }
+        private:
+            std::tuple<coroutine<T>...> children;
+            std::size_t remaining = sizeof...(T);
+            std::size_t winner = sizeof...(T);
+            std::coroutine_handle<> waiter = nullptr;
+            events::event_loop* loop = nullptr;
+            bool starting = false;
+
+            bool done() const {
+                return any ? winner != sizeof...(T) : remaining == 0;
+            }
+            template<typename R>
+            void start(coroutine<R>& c, std::coroutine_handle<> caller) {
+                if(!c) {
+                    debug::kerror("Tried to start an empty coroutine in a group: {}", c.address());
+                    complete(c);
+                    return;
+                }
+                start_child(c, this, loop, caller);
+            }
+            void complete(std::coroutine_handle<> child) {
+                remaining--;
+                if(any && winner == sizeof...(T)) {
+                    std::size_t i = 0;
+                    std::apply([&](auto&... c) { ((c.address() == child.address() ? void(winner = i) : void(), i++), ...); }, children);
+                }
+            }
+            static std::coroutine_handle<> finished(completion* self, std::coroutine_handle<> child) {
+                auto* join = static_cast<when_awaiter*>(self);
+                bool was_done = join->done();
+                join->complete(child);
+                if(join->starting || was_done || !join->done()) {
+                    return std::noop_coroutine();
+                }
+                join->loop->current_coroutine = join->waiter;
+                return join->waiter;
+            }
+            template<typename R>
+            static void destroy(coroutine<R>& c) {
+                if(c) {
+                    c.release().destroy();
+                }
+            }
+            template<typename R>
+            static result_t<R> result(coroutine<R>& c) {
+                if constexpr(std::is_void_v<R>) {
+                    return {};
+                } else {
+                    return c ? std::move(c.promise().result) : R{};
+                }
+            }
+    };
+}
+
+/**
+ * Runs all `children` concurrently on the event loop of the awaiting coroutine and
+ * resumes it once every one of them has finished.
+ * Returns a tuple with the results of all children, `std::monostate` for children returning void.
+ */
+template<typename... T>
+[[nodiscard("The awaiter must be awaited.")]] auto when_all(coroutine<T>&&... children) {
+    return detail::when_awaiter<false, T...>{std::move(children)...};
+}
+/**
+ * Runs all `children` concurrently on the event loop of the awaiting coroutine and
+ * resumes it as soon as the first one has finished.
+ * The remaining children are cancelled by destroying their frames, which unlinks whatever they are waiting on.
+ * Returns the index of the child that finished first.
+ */
+template<typename... T>
+[[nodiscard("The awaiter must be awaited.")]] auto when_any(coroutine<T>&&... children) {
+    return detail::when_awaiter<true, T...>{std::move(children)...};
+}
+
+/**
+ * Owns up to `N` child coroutines running concurrently to the coroutine that spawned them.
+ *
+ * Children are started with `co_await group.spawn(child())`, which does not suspend the caller,
+ * and their frames are freed as soon as they finish. `co_await group.join()` waits for all of them.
+ * Destroying the group cancels every child that is still running, so no child outlives its group.
+ */
+template<std::size_t N>
+class task_group : detail::completion {
+    public:
+        task_group() : completion{&finished} {}
+        task_group(const task_group&) = delete;
+        task_group& operator=(const task_group&) = delete;
+        ~task_group() {
+            cancel();
+        }
+
+        class spawn_awaiter {
+            task_group* group;
+            std::coroutine_handle<> child;
+            bool started = false;
+        public:
+            spawn_awaiter(task_group* group, std::coroutine_handle<> child) : group(group), child(child) {}
+            spawn_awaiter(const spawn_awaiter&) = delete;
+            spawn_awaiter& operator=(const spawn_awaiter&) = delete;
+            ~spawn_awaiter() {
+                if(!started && child) {
+                    child.destroy();
+                }
+            }
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return false;
+            }
+            bool await_suspend(std::coroutine_handle<> caller) noexcept {
+                auto loop = get_event_loop(caller);
+                if(!loop) {
+                    panic("Event loop is null");
+                }
+                started = group->start(child, loop, caller);
+                return false;
+            }
+            /**
+             * Returns `false` if the group is full or the child could not be allocated.
+             */
+            bool await_resume() const noexcept {
+                return started;
+            }
+        };
+        class join_awaiter {
+            task_group* group;
+        public:
+            join_awaiter(task_group* group) : group(group) {}
+            ~join_awaiter() {
+                group->waiter = nullptr;
+            }
+
+            [[nodiscard]] bool await_ready() const noexcept {
+                return group->running == 0;
+            }
+            bool await_suspend(std::coroutine_handle<> caller) noexcept {
+                if(group->waiter) {
+                    panic("Task group already has a waiting coroutine");
+                }
+                group->waiter = caller;
+                set_coroutine_state(caller, coroutine_state::waiting_children);
+                group->loop->current_coroutine = nullptr;
+                return true;
+            }
+            void await_resume() const noexcept {}
+        };
+
+        /**
+         * Starts `child` on the event loop of the awaiting coroutine.
+         * The child runs up until its first co_await before the caller continues.
+         */
+        template<typename T>
+        [[nodiscard("The awaiter must be awaited.")]] spawn_awaiter spawn(coroutine<T>&& child) {
+            return spawn_awaiter{this, child.release()};
+        }
+        /**
+         * Returns an awaiter that waits until all children have finished.
+         */
+        [[nodiscard("The awaiter must be awaited.")]] join_awaiter join() {
+            return join_awaiter{this};
+        }
+        /**
+         * Destroys all children that are still running.
+         */
+        void cancel() {
+            for(auto& c : children) {
+                if(c) {
+                    std::exchange(c, nullptr).destroy();
+                }
+            }
+            running = 0;
+        }
+
+        std::size_t size() const {
+            return running;
+        }
+        static constexpr std::size_t capacity() {
+            return N;
+        }
+    private:
+        std::array<std::coroutine_handle<>, N> children{};
+        std::size_t running = 0;
+        std::coroutine_handle<> waiter = nullptr;
+        events::event_loop* loop = nullptr;
+
+        bool start(std::coroutine_handle<> child, events::event_loop* loop, std::coroutine_handle<> caller) {
+            if(!child) {
+                debug::kerror("Tried to spawn an empty coroutine: {}", child.address());
+                return false;
+            }
+            if(this->loop && this->loop != loop) {
+                panic("Task group spawned coroutines on different event loops");
+            }
+            for(auto& c : children) {
+                if(!c) {
+                    c = child;
+                    running++;
+                    this->loop = loop;
+                    detail::start_child(child, this, loop, caller);
+                    return true;
+                }
+            }
+            debug::kwarn("Task group is full, cannot spawn coroutine {}", get_coroutine_info(child));
+            return false;
+        }
+        static std::coroutine_handle<> finished(completion* self, std::coroutine_handle<> child) {
+            auto* group = static_cast<task_group*>(self);
+            for(auto& c : group->children) {
+                if(c == child) {
+                    c = nullptr;
+                }
+            }
+            child.destroy();
+            if(--group->running > 0 || !group->waiter) {
+                return std::noop_coroutine();
+            }
+            auto waiter = std::exchange(group->waiter, nullptr);
+            group->loop->current_coroutine = waiter;
+            return waiter;
+        }
+};
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <config.hpp>
+#include <lib/io.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+
+/**
+ * Compact binary telemetry that shares the serial link with the text console.
+ *
+ * Every frame is `channel | payload | crc16` (CRC-16/CCITT-FALSE over channel and payload),
+ * COBS encoded and enclosed in `0x00` delimiters. Console text never contains `0x00`,
+ * so a decoder (see tools/telemetry_decode.py) can demultiplex both from one byte stream.
+ * Integers in the payload are encoded as unsigned LEB128 varints.
+ */
+namespace kernel::telemetry {
+
+enum class channel : uint8_t {
+    /** Sequence of (counter id, value) pairs. */
+    counters = 1,
+    /** One trace record: id, timestamp in microseconds, argument. */
+    trace = 2,
+    /** Sequence of sampled program counters. */
+    profiler = 3,
+};
+
+/**
+ * Counter ids used on the counters channel.
+ * Keep this in sync with the names in tools/telemetry_decode.py.
+ */
+enum class counter : uint8_t {
+    memory_allocated = 0,
+    memory_free = 1,
+    num_allocations = 2,
+    num_blocks = 3,
+    subscription_dropped = 4,
+    log_dropped = 5,
+    profiler_dropped = 6,
+};
+
+/**
+ * Trace point ids used on the trace channel.
+ * Keep this in sync with the names in tools/telemetry_decode.py.
+ */
+enum class trace_point : uint8_t {
+    /** An event loop dispatched an event other than a tick, the argument is the event type. */
+    event_dispatched = 0,
+};
+
+class frame {
+    public:
+        explicit frame(channel ch);
+
+        frame& put(uint8_t byte);
+        frame& varint(uint32_t value);
+
+        std::size_t size() const {
+            return m_size;
+        }
+        /**
+         * Returns `true` if at least `bytes` more bytes fit into the frame.
+         */
+        bool fits(std::size_t bytes) const {
+            return m_size + bytes <= sizeof(data);
+        }
+
+        /**
+         * Appends the CRC, COBS encodes the frame and writes it to `out` in one piece,
+         * serialized with all other frames. Must be called from thread context.
+         * Returns the number of bytes written to the wire.
+         */
+        std::size_t send(ostream& out) const;
+    private:
+        uint8_t data[config::telemetry_max_frame_size - 2]{};
+        std::size_t m_size = 0;
+};
+
+extern ostream* stream;
+
+bool enabled();
+void enable(bool on);
+
+void send_counters(std::initializer_list<std::pair<counter, uint32_t>> counters);
+/**
+ * Sends one trace record if telemetry is enabled. Must be called from thread context.
+ */
+void trace(trace_point id, uint32_t arg = 0);
+
+/**
+ * Records a sampled program counter. Safe to call from interrupt context.
+ */
+void record_sample(uint32_t pc);
+/**
+ * Sends all recorded samples. Must be called from thread context.
+ */
+void flush_samples();
+std::size_t samples_dropped();
+
+uint16_t crc16(const uint8_t* data, std::size_t size);
+/**
+ * COBS encodes `size` bytes from `in` into `out`, which must have room for `size + size/254 + 1` bytes.
+ * Returns the encoded size.
+ */
+std::size_t cobs_encode(const uint8_t* in, std::size_t size, uint8_t* out);
+
+}
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "arch/arm/interrupts.hpp"
 #include "kernel/basic.hpp"
 #include "kernel/debug.hpp"
+#include "config.hpp"
 
 #include <expected>
 #include <type_traits>
@@ -15,12 +17,21 @@ namespace threads {
 
     using entry_point = std::add_pointer_t<void(void*)>;
 
+    /**
+     * Scheduling priority of a thread, from 0 to `config::thread_priorities - 1`.
+     * A ready thread always runs before all threads of lower priority and preempts them as soon as it becomes ready.
+     */
+    struct priority {
+        uint32_t value = config::thread_default_priority;
+    };
+
     enum class thread_create_error {
         no_free_thread,
         out_of_argument_memory,
         no_more_thread_ids,
+        invalid_priority,
     };
-    std::expected<unsigned int, thread_create_error> create(entry_point entry, const void* args, std::size_t args_size);
+    std::expected<unsigned int, thread_create_error> create(entry_point entry, const void* args, std::size_t args_size, priority prio = {});
 
     namespace detail {
         class prepared_thread {
@@ -36,7 +47,7 @@ namespace threads {
                     new(arg_pointer) T(std::forward<T>(arg));
                 }
             private:
-                friend std::expected<prepared_thread, thread_create_error> prepare_thread(entry_point entry, std::size_t args_size);
+                friend std::expected<prepared_thread, thread_create_error> prepare_thread(entry_point entry, std::size_t args_size, priority prio);
                 friend std::expected<unsigned int, thread_create_error> start_thread(prepared_thread thread);
 
                 prepared_thread(unsigned int id, void* block, char* arg_pointer) : id(id), block(block), arg_pointer(arg_pointer) {}
@@ -45,13 +56,13 @@ namespace threads {
                 void* block = nullptr;
                 char* arg_pointer = nullptr;
         };
-        std::expected<prepared_thread, thread_create_error> prepare_thread(entry_point entry, std::size_t args_size);
+        std::expected<prepared_thread, thread_create_error> prepare_thread(entry_point entry, std::size_t args_size, priority prio);
         std::expected<unsigned int, thread_create_error> start_thread(prepared_thread thread);
     };
 
     template<typename T>
-    std::expected<unsigned int, thread_create_error> create(entry_point entry, T&& arg) {
-        auto prepared = detail::prepare_thread(entry, sizeof(T));
+    std::expected<unsigned int, thread_create_error> create(entry_point entry, T&& arg, priority prio = {}) {
+        auto prepared = detail::prepare_thread(entry, sizeof(T), prio);
         if(!prepared)
             return std::unexpected(prepared.error());
 
@@ -67,6 +78,85 @@ namespace threads {
 
     [[noreturn]] void terminate();
     void yield();
+    /**
+     * Identifies the calling thread, e.g. to tell whether it is the one running an event loop.
+     */
+    const void* current();
+
+    /**
+     * Blocks the calling thread as long as `*word == expected`, until another thread or
+     * an interrupt handler calls `unpark` or `wake` for `word` or the system timer reaches `deadline`
+     * (in microseconds, 0 means no deadline).
+     * Returns right away if `*word != expected` or the deadline has already passed,
+     * so a wakeup between reading `*word` and parking is never lost.
+     *
+     * Together with `wake` this works like a futex: the fast path of a lock or flag is an atomic
+     * operation on the word, only contended cases need to enter the kernel.
+     */
+    void park(const volatile uint32_t* word, uint32_t expected, uint64_t deadline = 0);
+    /**
+     * Wakes up to `count` threads parked on `word` and returns how many were woken. Must be called from a thread.
+     */
+    uint32_t wake(const volatile uint32_t* word, uint32_t count);
+    /**
+     * Wakes all threads parked on `word`. Must be called from a thread.
+     */
+    void unpark(const volatile uint32_t* word);
+    /**
+     * Wakes all threads parked on `word`. Must be called from an interrupt handler.
+     */
+    void unpark_from_interrupt(const volatile uint32_t* word);
+
+    /**
+     * Blocks the calling thread until the system timer reaches `deadline` (in microseconds).
+     * The thread uses no CPU time while it sleeps.
+     */
+    void sleep_until(uint64_t deadline);
+    /**
+     * Blocks the calling thread for at least `microseconds`, see `sleep_until`.
+     */
+    void sleep_for(uint64_t microseconds);
+
+    /**
+     * Interrupt sources a thread can block on with `wait_for`.
+     */
+    enum class wait_source : uint32_t {
+        uart,
+        count,
+    };
+    /**
+     * Number of times `wake_from_interrupt` was called for `source` so far, pass it to `wait_for`.
+     */
+    uint32_t wait_sequence(wait_source source);
+    /**
+     * Blocks the calling thread until an interrupt handler calls `wake_from_interrupt` for `source`
+     * or the system timer reaches `deadline` (0 means no deadline).
+     * Returns right away if that already happened since `wait_sequence` returned `sequence`,
+     * so read the sequence before checking whether there is anything to wait for.
+     */
+    void wait_for(wait_source source, uint32_t sequence, uint64_t deadline = 0);
+    /**
+     * Wakes all threads waiting for `source`. Must be called from an interrupt handler.
+     */
+    void wake_from_interrupt(wait_source source);
+
+    /**
+     * Selects how yields and the ends of timeslices switch threads: with `true` (the default after `init`)
+     * through the assembly paths in arch/arm/context_switch.S, otherwise through `handle_interrupt`
+     * like every other exception. Only meant for comparing both.
+     */
+    void set_fast_switch(bool enabled);
+
+    /**
+     * Switches to the highest priority ready thread if an interrupt handler woke one that ranks above the running thread.
+     * Called once at the end of interrupt processing.
+     */
+    void preempt_if_needed(cpu::interrupts::interrupt_context& ctx);
+
+    /**
+     * Total time the CPU spent waiting for interrupts because no thread was ready, in microseconds.
+     */
+    uint64_t idle_time();
 }
 
 namespace detail {
@@ -117,12 +207,17 @@ class thread {
         };
 
         template<typename Func, typename... Args>
-        thread(Func func, Args... args) requires std::is_invocable_v<Func, Args...> {
+        thread(Func func, Args... args) requires std::is_invocable_v<Func, Args...>
+            : thread(threads::priority{}, func, args...) {}
+
+        template<typename Func, typename... Args>
+        thread(threads::priority prio, Func func, Args... args) requires std::is_invocable_v<Func, Args...> {
             auto call = [func, args..., detached = detail::set_pointer(false, detached), &done = this->done]() mutable {
                 func(args...);
                 debug::ktrace("Thread is detached at its end? {} at {}", *detached, &detached.value);
                 if(!*detached) {
-                    done = true;
+                    done = 1;
+                    threads::unpark(&done);
                 }
             };
 
@@ -133,7 +228,7 @@ class thread {
             };
 
             debug::ktrace("Before place-move deatched = {}", reinterpret_cast<volatile void*>(detached));
-            auto ret = threads::create(entry, std::move(call));
+            auto ret = threads::create(entry, std::move(call), prio);
             debug::ktrace("After place-move deatched = {}", reinterpret_cast<volatile void*>(detached));
             if(ret.has_value()) {
                 handle = ret.value();
@@ -164,7 +259,9 @@ class thread {
                 kernel::panic("Thread not joinable!");
             }
 
-            while(!done) {}
+            while(!done) {
+                threads::park(&done, 0);
+            }
 
             handle = 0;
         }
@@ -184,7 +281,7 @@ class thread {
         }
     private:
         unsigned int handle = 0;
-        volatile bool done = false;
+        volatile uint32_t done = 0;
         volatile bool* detached = nullptr;
 };
 
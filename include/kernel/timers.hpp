@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <lib/list.hpp>
+
+namespace kernel::timers {
+
+class timing_wheel;
+
+/**
+ * A one-shot timer that calls `func(timer, userdata)` once its deadline has passed.
+ * Timers are intrusive, so a wheel can hold any number of them without allocating.
+ * A timer cancels itself when destroyed.
+ */
+class timer : public list_mixin<timer> {
+    public:
+        using callback = std::add_pointer_t<void(timer&, void*)>;
+
+        constexpr timer() = default;
+        constexpr timer(callback func, void* userdata) : func(func), userdata(userdata) {}
+        timer(const timer&) = delete;
+        timer& operator=(const timer&) = delete;
+        ~timer() {
+            cancel();
+        }
+
+        /**
+         * Absolute deadline in microseconds of the system timer.
+         */
+        uint64_t deadline() const {
+            return m_deadline;
+        }
+        bool pending() const {
+            return linked();
+        }
+        void set_callback(callback func, void* userdata) {
+            this->func = func;
+            this->userdata = userdata;
+        }
+        /**
+         * Removes the timer from its wheel without firing it.
+         * Does nothing if the timer is not pending.
+         */
+        void cancel();
+    private:
+        uint64_t m_deadline = 0;
+        uint32_t expires = 0;
+        callback func = nullptr;
+        void* userdata = nullptr;
+        timing_wheel* wheel = nullptr;
+
+        friend class timing_wheel;
+};
+
+struct timer_statistics {
+    std::size_t pending{};
+    std::size_t pending_high_water{};
+    std::size_t added{};
+    std::size_t fired{};
+    std::size_t cancelled{};
+    std::size_t cascaded{};
+    /** Number of advances that fired at least one timer. */
+    std::size_t batches{};
+    std::size_t max_batch{};
+    /** Longest time between a deadline and the advance that fired the timer, in microseconds. */
+    uint32_t max_slack{};
+};
+
+/**
+ * A hierarchical timing wheel with `levels` levels of `slots` slots each.
+ *
+ * Level 0 has a resolution of one tick (`1 << tick_shift` microseconds), every further level
+ * covers `slots` times the range of the level below. Timers in higher levels are cascaded
+ * down when the lower level wraps around. Adding and cancelling a timer is O(1),
+ * all timers expiring in the same tick are fired as one batch.
+ * Deadlines further away than the range of the wheel (about 4.8 hours) are parked in the last level
+ * and re-inserted until they are in range.
+ */
+class timing_wheel {
+    public:
+        static constexpr unsigned int tick_shift = 10;
+        static constexpr unsigned int level_bits = 6;
+        static constexpr unsigned int levels = 4;
+        static constexpr unsigned int slots = 1 << level_bits;
+        static constexpr uint32_t tick = 1 << tick_shift;
+
+        constexpr timing_wheel() = default;
+        timing_wheel(const timing_wheel&) = delete;
+        timing_wheel& operator=(const timing_wheel&) = delete;
+
+        /**
+         * Arms `t` to fire at `deadline` (both in microseconds of the system timer).
+         * The timer never fires early, but up to one tick late.
+         */
+        void add(timer* t, uint64_t deadline, uint64_t now);
+        void cancel(timer* t);
+        /**
+         * Advances the wheel to `now` and fires every timer whose deadline has passed.
+         * Returns the number of timers fired.
+         */
+        std::size_t advance(uint64_t now);
+        /**
+         * Returns the time by which `advance` has to be called next, because a timer expires
+         * or a higher level has to be cascaded, or 0 if no timer is pending.
+         * Only valid right after `advance(now)`.
+         */
+        uint64_t next_deadline(uint64_t now) const;
+
+        bool empty() const {
+            return pending() == 0;
+        }
+        std::size_t pending() const {
+            return stats.added - stats.fired - stats.cancelled;
+        }
+        timer_statistics statistics() const;
+    private:
+        list<timer> wheel[levels][slots]{};
+        /** Timers added with a deadline that is already due, fired by the next advance. */
+        list<timer> due{};
+        /** The last tick that has been processed. */
+        uint32_t current = 0;
+        timer_statistics stats{};
+
+        void insert(timer* t);
+        void cascade(unsigned int level);
+
+        static uint32_t to_tick(uint64_t time) {
+            return static_cast<uint32_t>(time >> tick_shift);
+        }
+};
+
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "kernel/basic.hpp"
+
+#include <cstddef>
+
+namespace kernel {
+
+template<typename T>
+class list;
+
+/**
+ * Intrusive doubly linked list node.
+ * Every node knows the list it is in, so it can be unlinked in O(1) without knowing that list.
+ * Copying a node yields an unlinked node.
+ */
+template<typename T>
+struct list_mixin {
+    public:
+        constexpr list_mixin() = default;
+        list_mixin(const list_mixin&) {}
+        list_mixin& operator=(const list_mixin&) {
+            return *this;
+        }
+
+        bool linked() const {
+            return owner != nullptr;
+        }
+        /**
+         * Removes this node from the list it is in, if any.
+         */
+        void unlink() {
+            if(owner) {
+                owner->remove(static_cast<T*>(this));
+            }
+        }
+    private:
+        T* prev = nullptr;
+        T* next = nullptr;
+        list<T>* owner = nullptr;
+        friend list<T>;
+};
+
+template<typename T>
+class list {
+    T* head = nullptr;
+    T* tail = nullptr;
+    std::size_t length = 0;
+public:
+    constexpr list() {}
+    list(const list&) = delete;
+    list& operator=(const list&) = delete;
+
+    T* front() const {
+        return head;
+    }
+    T* back() const {
+        return tail;
+    }
+    bool empty() const {
+        return head == nullptr;
+    }
+    std::size_t size() const {
+        return length;
+    }
+    static T* next(const T* element) {
+        return element->list_mixin<T>::next;
+    }
+
+    void push_back(T* element) {
+        check_unlinked(element);
+        element->list_mixin<T>::owner = this;
+        element->list_mixin<T>::prev = tail;
+        element->list_mixin<T>::next = nullptr;
+        if(tail) {
+            tail->list_mixin<T>::next = element;
+        } else {
+            head = element;
+        }
+        tail = element;
+        length++;
+    }
+    void push_front(T* element) {
+        check_unlinked(element);
+        element->list_mixin<T>::owner = this;
+        element->list_mixin<T>::prev = nullptr;
+        element->list_mixin<T>::next = head;
+        if(head) {
+            head->list_mixin<T>::prev = element;
+        } else {
+            tail = element;
+        }
+        head = element;
+        length++;
+    }
+    /**
+     * Inserts `element` in front of `position`, which must be in this list, or at the back if `position` is null.
+     */
+    void insert_before(T* position, T* element) {
+        if(!position) {
+            push_back(element);
+            return;
+        }
+        if(position->list_mixin<T>::owner != this) {
+            panic("Tried to insert a list element next to one that is not in the list");
+        }
+        check_unlinked(element);
+        T* prev = position->list_mixin<T>::prev;
+        element->list_mixin<T>::owner = this;
+        element->list_mixin<T>::prev = prev;
+        element->list_mixin<T>::next = position;
+        position->list_mixin<T>::prev = element;
+        if(prev) {
+            prev->list_mixin<T>::next = element;
+        } else {
+            head = element;
+        }
+        length++;
+    }
+    void remove(T* element) {
+        if(element->list_mixin<T>::owner != this) {
+            panic("Tried to remove a list element from a list it is not in");
+        }
+        T* prev = element->list_mixin<T>::prev;
+        T* next = element->list_mixin<T>::next;
+        if(prev) {
+            prev->list_mixin<T>::next = next;
+        } else {
+            head = next;
+        }
+        if(next) {
+            next->list_mixin<T>::prev = prev;
+        } else {
+            tail = prev;
+        }
+        element->list_mixin<T>::prev = nullptr;
+        element->list_mixin<T>::next = nullptr;
+        element->list_mixin<T>::owner = nullptr;
+        length--;
+    }
+    T* pop_front() {
+        T* element = head;
+        if(element) {
+            remove(element);
+        }
+        return element;
+    }
+private:
+    static void check_unlinked(const T* element) {
+        if(element->list_mixin<T>::owner) {
+            panic("Tried to add a list element that already is in a list");
+        }
+    }
+};
+
+}
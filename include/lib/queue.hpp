@@ -4,6 +4,9 @@
 
 namespace kernel {
 
+template<typename T>
+struct queue_mixin;
+
 template<typename T>
 class queue {
     T* head = nullptr;
@@ -18,24 +21,24 @@ public:
     T* remove() {
         if(head) {
             auto* y = head;
-            head = y->next;
+            head = y->queue_mixin<T>::next;
             if(head == nullptr) {
                 tail = nullptr;
             }
 
             // This is important, so we can re-add the element to a new queue later on
-            y->next = nullptr;
+            y->queue_mixin<T>::next = nullptr;
             return y;
         }
         return nullptr;
     }
     void add(T* y) {
-        if(y->next) {
+        if(y->queue_mixin<T>::next) {
             panic("Tried to add a queue element that already has a next element");
         }
 
         if(tail) {
-            tail->next = y;
+            tail->queue_mixin<T>::next = y;
             tail = y;
         }
         else {
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include <utility>
+
+namespace kernel {
+
+/**
+ * A fixed size single-producer single-consumer ring buffer.
+ *
+ * The producer and the consumer may run in different contexts (e.g. an interrupt handler and a thread),
+ * the positions are published with release/acquire ordering, so no further locking is required
+ * as long as there is only one producer and one consumer at a time.
+ */
+template<typename T, std::size_t N>
+class ring_buffer {
+    static_assert(N > 0 && (N & (N-1)) == 0, "Ring buffer size must be a power of two");
+    public:
+        constexpr ring_buffer() = default;
+
+        /**
+         * Appends `value` to the buffer.
+         * Returns `false` if the buffer is full.
+         */
+        bool push(T&& value) {
+            std::size_t w = write_pos.load(std::memory_order_relaxed);
+            if(w - read_pos.load(std::memory_order_acquire) == N) {
+                return false;
+            }
+            buffer[w & mask] = std::move(value);
+            write_pos.store(w + 1, std::memory_order_release);
+            return true;
+        }
+        bool push(const T& value) {
+            T copy = value;
+            return push(std::move(copy));
+        }
+
+        /**
+         * Appends as many elements of `values` as fit into the buffer.
+         * Returns the number of elements appended.
+         */
+        std::size_t push(std::span<const T> values) {
+            std::size_t w = write_pos.load(std::memory_order_relaxed);
+            std::size_t count = std::min(values.size(), N - (w - read_pos.load(std::memory_order_acquire)));
+            for(std::size_t i=0; i<count; i++) {
+                buffer[(w + i) & mask] = values[i];
+            }
+            write_pos.store(w + count, std::memory_order_release);
+            return count;
+        }
+
+        /**
+         * Removes the oldest element from the buffer and places it in `value`.
+         * Returns `false` if the buffer is empty.
+         */
+        bool pop(T& value) {
+            std::size_t r = read_pos.load(std::memory_order_relaxed);
+            if(write_pos.load(std::memory_order_acquire) == r) {
+                return false;
+            }
+            value = std::move(buffer[r & mask]);
+            read_pos.store(r + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Removes up to `values.size()` of the oldest elements from the buffer and places them in `values`.
+         * Returns the number of elements removed.
+         */
+        std::size_t pop(std::span<T> values) {
+            std::size_t r = read_pos.load(std::memory_order_relaxed);
+            std::size_t count = std::min(values.size(), write_pos.load(std::memory_order_acquire) - r);
+            for(std::size_t i=0; i<count; i++) {
+                values[i] = std::move(buffer[(r + i) & mask]);
+            }
+            read_pos.store(r + count, std::memory_order_release);
+            return count;
+        }
+
+        std::size_t size() const {
+            return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire);
+        }
+        bool empty() const {
+            return size() == 0;
+        }
+        bool full() const {
+            return size() == N;
+        }
+        static constexpr std::size_t capacity() {
+            return N;
+        }
+    private:
+        static constexpr std::size_t mask = N - 1;
+
+        T buffer[N]{};
+        std::atomic<std::size_t> read_pos{0};
+        std::atomic<std::size_t> write_pos{0};
+};
+
+}
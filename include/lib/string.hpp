@@ -39,8 +39,9 @@ std::expected<T, parse_error> string_to_integral(std::string_view sv, int base =
         return std::unexpected(parse_error::illegal_base);
     }
 
-    sv.remove_prefix(sv.find_first_not_of(" "));
-    if(sv.empty()) return std::unexpected(parse_error::empty);
+    auto start = sv.find_first_not_of(" ");
+    if(start == std::string_view::npos) return std::unexpected(parse_error::empty);
+    sv.remove_prefix(start);
 
     bool negative = false;
     if constexpr (std::is_signed_v<T>) {
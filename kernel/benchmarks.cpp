@@ -0,0 +1,612 @@
+#include <kernel/benchmarks.hpp>
+
+#include <arch/arm/interrupts.hpp>
+#include <drivers/interrupt_controller.hpp>
+#include <drivers/timer.hpp>
+#include <kernel/channel.hpp>
+#include <kernel/debug.hpp>
+#include <kernel/events.hpp>
+#include <kernel/fiber.hpp>
+#include <kernel/generator.hpp>
+#include <kernel/task_group.hpp>
+#include <kernel/threads.hpp>
+#include <kernel/timers.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+namespace kernel::benchmarks {
+
+using debug::kprintln;
+using driver::timer::system_timer;
+using driver::interrupts::interrupt_source;
+
+constexpr uint32_t max_stress_batch = 32;
+static volatile uint32_t stress_fired = 0;
+static uint32_t stress_batch = 0;
+
+coroutine<void> stress_event_queue(uint32_t duration, uint32_t interval, uint32_t events_per_interrupt, coroutine_name) {
+    auto& loop = events::main_event_loop;
+    loop.reset_statistics();
+    auto before = loop.statistics();
+
+    stress_fired = 0;
+    stress_batch = std::clamp<uint32_t>(events_per_interrupt, 1, max_stress_batch);
+    kprintln("Firing {} events every {} us for {} us...", stress_batch, interval, duration);
+
+    // compare channel 0 is not used by the kernel otherwise
+    driver::timer::setup(system_timer::sys_timer0, interval,
+        [](system_timer, uint32_t value, cpu::interrupts::interrupt_context&, void*) {
+            // one high priority event per interrupt, to see how its latency holds up against the flood
+            events::main_event_loop.fire_event({.type = events::type::user, .data = value}, events::priority::high);
+            events::event batch[max_stress_batch];
+            for(uint32_t i=1; i<stress_batch; i++) {
+                batch[i] = {.type = events::type::user, .data = value};
+            }
+            events::main_event_loop.fire_events({batch + 1, stress_batch - 1});
+            stress_fired = stress_fired + stress_batch;
+        }, nullptr);
+    driver::interrupts::enable_source(interrupt_source::sys_timer0);
+
+    uint32_t received = 0;
+    uint64_t end = driver::timer::now() + duration;
+    while(driver::timer::now() < end) {
+        co_await events::awaiter(events::type::user);
+        received++;
+    }
+    driver::interrupts::disable_source(interrupt_source::sys_timer0);
+
+    // collect everything that is still queued, every fired event is either received or counted as an overrun
+    while(received + (loop.statistics().queue_overruns - before.queue_overruns) < stress_fired) {
+        co_await events::awaiter(events::type::user);
+        received++;
+    }
+
+    auto after = loop.statistics();
+    kprintln("  fired            = {}", static_cast<uint32_t>(stress_fired));
+    kprintln("  received         = {}", received);
+    kprintln("  overruns         = {}", after.queue_overruns - before.queue_overruns);
+    kprintln("  queue_high_water = {} (of {})", after.queue_high_water, config::event_queue_size);
+    kprintln("  steps            = {}", after.steps - before.steps);
+    kprintln("  budget_exhausted = {}", after.budget_exhausted - before.budget_exhausted);
+    for(std::size_t p = 0; p < events::priority_count; p++) {
+        const auto& c = after.classes[p];
+        kprintln("  {:<6} events = {:>8}, overruns = {:>8}, latency = {} cycles average, {} cycles max",
+            static_cast<events::priority>(p), c.events_processed - before.classes[p].events_processed,
+            c.queue_overruns - before.classes[p].queue_overruns, c.latency_average, c.latency_max);
+    }
+    co_return;
+}
+
+static coroutine<void> waiter(uint32_t id, uint32_t rounds, events::awaiter::predicate filter, uint32_t& resumes, uint32_t& finished,
+    coroutine_name = "bench waiter") {
+    for(uint32_t r=0; r<rounds; r++) {
+        co_await events::awaiter(events::type::user, filter, id);
+        resumes++;
+    }
+    finished++;
+}
+
+coroutine<void> bench_waiters(uint32_t waiters, uint32_t rounds, coroutine_name) {
+    auto& loop = *get_event_loop(co_await get_coroutine_handle());
+
+    for(bool filtered : {true, false}) {
+        uint32_t resumes = 0;
+        uint32_t finished = 0;
+        uint32_t started = 0;
+        for(uint32_t i=0; i<waiters; i++) {
+            if(loop.submit_coroutine(waiter(i, rounds, filtered ? events::filter::equal : nullptr, resumes, finished))) {
+                started++;
+            }
+        }
+        if(started < waiters) {
+            debug::kwarn("Only {} of {} waiters could be started.", started, waiters);
+        }
+
+        uint32_t dispatches = 0;
+        uint64_t start = driver::timer::now();
+        for(uint32_t r=0; r<rounds; r++) {
+            // filtered waiters only wake up for their own id, unfiltered ones for every event
+            for(uint32_t i=0; i<(filtered ? started : 1); i++) {
+                loop.dispatch({.type = events::type::user, .data = i});
+                dispatches++;
+            }
+        }
+        uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+        if(finished != started) {
+            debug::kwarn("Only {} of {} waiters finished.", finished, started);
+        }
+
+        kprintln("{} waiters ({}):", started, filtered ? "filtered" : "unfiltered");
+        kprintln("  dispatches          = {}", dispatches);
+        kprintln("  resumes             = {}", resumes);
+        kprintln("  resumes/dispatch    = {}", dispatches ? resumes / dispatches : 0);
+        kprintln("  elapsed             = {} us", elapsed);
+        // there is no libgcc for 64-bit division, 32 bits are enough for a few seconds
+        kprintln("  ns/dispatch         = {}", dispatches ? elapsed * 1000 / dispatches : 0);
+    }
+}
+
+constexpr uint32_t max_bench_timers = 4096;
+static timers::timer bench_timer_storage[max_bench_timers];
+static struct {
+    uint32_t fired;
+    uint32_t total_slack;
+    uint32_t max_slack;
+    uint32_t total_latency;
+    uint32_t max_latency;
+} bench_timer_results;
+
+coroutine<void> bench_timers(uint32_t count, uint32_t spread, coroutine_name) {
+    auto& loop = *get_event_loop(co_await get_coroutine_handle());
+    count = std::min(count, max_bench_timers);
+    spread = std::max<uint32_t>(spread, 1);
+    bench_timer_results = {};
+    auto before = loop.timer_statistics();
+
+    auto on_fire = [](timers::timer& t, void*) {
+        uint32_t now = static_cast<uint32_t>(driver::timer::now());
+        uint32_t slack = now - static_cast<uint32_t>(t.deadline());
+        // the wheel tick the timer became due in
+        uint32_t due = static_cast<uint32_t>(t.deadline() + timers::timing_wheel::tick - 1) & ~(timers::timing_wheel::tick - 1);
+        uint32_t latency = now - due;
+        auto& r = bench_timer_results;
+        r.fired++;
+        r.total_slack += slack;
+        r.max_slack = std::max(r.max_slack, slack);
+        r.total_latency += latency;
+        r.max_latency = std::max(r.max_latency, latency);
+    };
+
+    uint32_t seed = 1;
+    uint64_t start = driver::timer::now();
+    for(uint32_t i=0; i<count; i++) {
+        seed = seed * 1664525 + 1013904223;
+        bench_timer_storage[i].set_callback(on_fire, nullptr);
+        loop.add_timer(&bench_timer_storage[i], start + 1000 + (seed >> 8) % spread);
+    }
+    uint32_t add_time = static_cast<uint32_t>(driver::timer::now() - start);
+
+    uint32_t cancelled = 0;
+    uint64_t cancel_start = driver::timer::now();
+    for(uint32_t i=0; i<count; i+=4) {
+        bench_timer_storage[i].cancel();
+        cancelled++;
+    }
+    uint32_t cancel_time = static_cast<uint32_t>(driver::timer::now() - cancel_start);
+
+    co_await events::sleep_until(start + 1000 + spread + timers::timing_wheel::tick);
+
+    auto after = loop.timer_statistics();
+    const auto& r = bench_timer_results;
+    // there is no libgcc for 64-bit division, all values here fit into 32 bits
+    kprintln("{} timers over {} us, {} cancelled:", count, spread, cancelled);
+    kprintln("  ns/add      = {}", count ? add_time * 1000 / count : 0);
+    kprintln("  ns/cancel   = {}", cancelled ? cancel_time * 1000 / cancelled : 0);
+    kprintln("  fired       = {} (expected {})", r.fired, count - cancelled);
+    kprintln("  slack       = {} us average, {} us max", r.fired ? r.total_slack / r.fired : 0, r.max_slack);
+    kprintln("  latency     = {} us average, {} us max", r.fired ? r.total_latency / r.fired : 0, r.max_latency);
+    kprintln("  batches     = {}", after.batches - before.batches);
+    kprintln("  max_batch   = {}", after.max_batch);
+    kprintln("  cascaded    = {}", after.cascaded - before.cascaded);
+    kprintln("  high_water  = {}", after.pending_high_water);
+
+    {
+        // a thread parked with a deadline beyond the 2^31 us reach of the compare registers
+        static volatile uint32_t far_wakeup;
+        far_wakeup = 0;
+        thread sleeper{[]() {
+            threads::park(&far_wakeup, 0, driver::timer::now() + (uint64_t{1} << 32));
+        }};
+        uint64_t parked_at = driver::timer::now();
+        co_await events::sleep_until(parked_at + 10000);
+        far_wakeup = 1;
+        threads::wake(&far_wakeup, 1);
+        sleeper.join();
+        kprintln("  far_deadline = woken after {} us", static_cast<uint32_t>(driver::timer::now() - parked_at));
+    }
+}
+
+constexpr uint32_t max_bench_yielders = 512;
+static struct {
+    uint16_t runs[max_bench_yielders];
+    uint32_t finished;
+    // snapshot of the run counts when the first coroutine finished
+    uint32_t min[2];
+    uint32_t max[2];
+} bench_yield_results;
+
+static coroutine<void> yielder(uint32_t id, uint32_t count, uint32_t rounds, uint32_t weight, coroutine_name = "bench yielder") {
+    auto& r = bench_yield_results;
+    for(uint32_t i=0; i<rounds; i++) {
+        co_await events::weighted_yield(weight);
+        r.runs[id]++;
+    }
+    if(r.finished++ == 0) {
+        for(uint32_t c=0; c<2; c++) {
+            r.min[c] = std::numeric_limits<uint32_t>::max();
+            r.max[c] = 0;
+        }
+        for(uint32_t i=0; i<count; i++) {
+            uint32_t c = (i % 4 == 0) ? 1 : 0;
+            r.min[c] = std::min<uint32_t>(r.min[c], r.runs[i]);
+            r.max[c] = std::max<uint32_t>(r.max[c], r.runs[i]);
+        }
+    }
+}
+
+coroutine<void> bench_yields(uint32_t count, uint32_t rounds, uint32_t weight, coroutine_name) {
+    auto& loop = *get_event_loop(co_await get_coroutine_handle());
+    count = std::min(count, max_bench_yielders);
+    bench_yield_results = {};
+    auto before = loop.statistics();
+
+    uint32_t started = 0;
+    for(uint32_t i=0; i<count; i++) {
+        if(!loop.submit_coroutine(yielder(i, count, rounds, i % 4 == 0 ? weight : 1))) {
+            break;
+        }
+        started++;
+    }
+    if(started < count) {
+        debug::kwarn("Only {} of {} coroutines could be started.", started, count);
+    }
+
+    uint64_t start = driver::timer::now();
+    while(bench_yield_results.finished < started) {
+        co_await events::yield();
+    }
+    uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+
+    auto after = loop.statistics();
+    const auto& r = bench_yield_results;
+    uint32_t yields = after.yields_processed - before.yields_processed;
+    kprintln("{} coroutines yielding {} times, every fourth with weight {}:", started, rounds, weight);
+    kprintln("  yields        = {}", yields);
+    kprintln("  elapsed       = {} us", elapsed);
+    // there is no libgcc for 64-bit division, 32 bits are enough for a few seconds
+    kprintln("  ns/yield      = {}", yields ? elapsed * 1000 / yields : 0);
+    kprintln("  steps         = {}", after.steps - before.steps);
+    kprintln("  high water    = {}", after.ready_queue_high_water);
+    kprintln("  runs when the first one finished:");
+    kprintln("    weight 1    = {} to {}", r.min[0], r.max[0]);
+    kprintln("    weight {:<4} = {} to {}", weight, r.min[1], r.max[1]);
+}
+
+struct message_latency {
+    uint32_t received = 0;
+    uint32_t total = 0;
+    uint32_t max = 0;
+
+    void record(uint32_t sent) {
+        uint32_t latency = cpu::cycle_counter() - sent;
+        received++;
+        total += latency;
+        max = std::max(max, latency);
+    }
+};
+
+using bench_channel = channel<uint32_t, 16>;
+
+static coroutine<void> channel_producer(bench_channel& ch, uint32_t messages, coroutine_name = "channel producer") {
+    for(uint32_t i=0; i<messages; i++) {
+        co_await ch.send(cpu::cycle_counter());
+    }
+}
+static coroutine<void> channel_consumer(bench_channel& ch, message_latency& latency, coroutine_name = "channel consumer") {
+    while(auto sent = co_await ch.receive()) {
+        latency.record(*sent);
+    }
+}
+/**
+ * A message handed to the event loop with `post`, which dispatches it as a `user` event.
+ * The event queues take events from interrupt context only, so coroutines go through `post` instead.
+ */
+struct posted_message {
+    events::posted_work work;
+    events::event_loop* loop;
+    uint32_t sent;
+};
+static posted_message posted_messages[bench_channel::capacity()];
+
+static coroutine<void> event_producer(events::event_loop& loop, uint32_t messages, coroutine_name = "event producer") {
+    for(uint32_t i=0; i<messages;) {
+        // as many messages as the channel buffers, then let the event loop dispatch them
+        for(uint32_t batch=0; batch<bench_channel::capacity() && i<messages; batch++, i++) {
+            auto& m = posted_messages[batch];
+            m.loop = &loop;
+            m.sent = cpu::cycle_counter();
+            m.work.func = [](events::posted_work&, void* userdata) {
+                auto* m = static_cast<posted_message*>(userdata);
+                m->loop->dispatch({.type = events::type::user, .data = m->sent});
+            };
+            m.work.userdata = &m;
+            loop.post(&m.work);
+        }
+        // the posted work runs at the start of the next step, before this coroutine is resumed and reuses it
+        co_await events::yield();
+    }
+}
+static coroutine<void> event_consumer(uint32_t messages, message_latency& latency, coroutine_name = "event consumer") {
+    while(latency.received < messages) {
+        latency.record(co_await events::awaiter(events::type::user));
+    }
+}
+
+static void print_message_results(const char* path, uint32_t pairs, uint32_t messages, uint32_t elapsed, const message_latency& latency) {
+    kprintln("{}, {} producer(s) and {} consumer(s):", path, pairs, pairs);
+    kprintln("  received    = {} (of {})", latency.received, messages);
+    kprintln("  elapsed     = {} us", elapsed);
+    // there is no libgcc for 64-bit division, 32 bits are enough for a few seconds
+    kprintln("  ns/message  = {}", latency.received ? elapsed * 1000 / latency.received : 0);
+    kprintln("  latency     = {} cycles average, {} cycles max", latency.received ? latency.total / latency.received : 0, latency.max);
+}
+
+coroutine<void> bench_channels(uint32_t messages, coroutine_name) {
+    auto& loop = *get_event_loop(co_await get_coroutine_handle());
+    constexpr uint32_t max_pairs = 4;
+
+    for(uint32_t pairs : {1u, max_pairs}) {
+        bench_channel ch;
+        message_latency latency[max_pairs]{};
+        task_group<2 * max_pairs> group;
+        uint64_t start = driver::timer::now();
+        for(uint32_t i=0; i<pairs; i++) {
+            co_await group.spawn(channel_consumer(ch, latency[i]));
+        }
+        for(uint32_t i=0; i<pairs; i++) {
+            co_await group.spawn(channel_producer(ch, messages / pairs));
+        }
+        // the consumers run until the channel is closed, so wait for the producers first
+        while(group.size() > pairs) {
+            co_await events::yield();
+        }
+        ch.close();
+        co_await group.join();
+        uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+
+        message_latency total{};
+        for(uint32_t i=0; i<pairs; i++) {
+            total.received += latency[i].received;
+            total.total += latency[i].total;
+            total.max = std::max(total.max, latency[i].max);
+        }
+        print_message_results("Channel", pairs, messages / pairs * pairs, elapsed, total);
+    }
+
+    message_latency latency{};
+    uint64_t start = driver::timer::now();
+    co_await when_all(event_consumer(messages, latency), event_producer(loop, messages));
+    uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+    print_message_results("Posted events", 1, messages, elapsed, latency);
+}
+
+static fiber_stack<0x1000> bench_fiber_stack;
+
+static generator<uint32_t> counter(uint32_t rounds, coroutine_name = "bench counter") {
+    for(uint32_t i=0; i<rounds; i++) {
+        co_yield i;
+    }
+}
+
+static async_generator<uint32_t> async_counter(coroutine_name = "bench async counter") {
+    for(uint32_t i=0;; i++) {
+        co_yield i;
+    }
+}
+
+coroutine<void> bench_switches(uint32_t rounds, coroutine_name) {
+    // every round switches into the fiber and back out again
+    {
+        fiber f{bench_fiber_stack, [rounds](fiber& self) {
+            for(uint32_t i=0; i<rounds; i++) {
+                self.yield();
+            }
+        }};
+        uint32_t start = cpu::cycle_counter();
+        while(f.resume()) {}
+        uint32_t cycles = cpu::cycle_counter() - start;
+        kprintln("Fiber switch:     {:>6} cycles", cycles / (2 * rounds));
+    }
+    for(bool fast : {false, true}) {
+        threads::set_fast_switch(fast);
+        const char* path = fast ? "assembly" : "generic";
+        {
+            // a trap into the kernel and back, through whichever threads of the same priority are ready in between
+            uint32_t start = cpu::cycle_counter();
+            for(uint32_t i=0; i<rounds; i++) {
+                threads::yield();
+            }
+            uint32_t cycles = cpu::cycle_counter() - start;
+            kprintln("Thread yield:     {:>6} cycles ({} path)", cycles / rounds, path);
+        }
+        {
+            // two threads of the same priority taking turns, so every yield switches threads
+            static volatile uint32_t stop;
+            stop = 0;
+            thread partner{threads::priority{config::main_thread_priority}, []() {
+                while(!stop) {
+                    threads::yield();
+                }
+            }};
+            uint32_t start = cpu::cycle_counter();
+            for(uint32_t i=0; i<rounds; i++) {
+                threads::yield();
+            }
+            uint32_t cycles = cpu::cycle_counter() - start;
+            stop = 1;
+            partner.join();
+            kprintln("Thread switch:    {:>6} cycles ({} path)", cycles / (2 * rounds), path);
+        }
+    }
+    {
+        uint32_t start = cpu::cycle_counter();
+        uint32_t sum = 0;
+        for(uint32_t i : counter(rounds)) {
+            sum += i;
+        }
+        uint32_t cycles = cpu::cycle_counter() - start;
+        kprintln("Coroutine switch: {:>6} cycles (checksum {})", cycles / (2 * rounds), sum);
+    }
+    {
+        // control passes by symmetric transfer, the generator never finishes and is cancelled at the end of the scope
+        auto gen = async_counter();
+        uint32_t start = cpu::cycle_counter();
+        uint32_t sum = 0;
+        for(uint32_t i=0; i<rounds; i++) {
+            sum += *co_await gen.next();
+        }
+        uint32_t cycles = cpu::cycle_counter() - start;
+        kprintln("Async generator:  {:>6} cycles (checksum {})", cycles / (2 * rounds), sum);
+    }
+    co_return;
+}
+
+constexpr uint32_t max_busy_threads = 16;
+constexpr uint32_t priority_probe_rounds = 20;
+constexpr uint32_t priority_probe_period = 1000;
+
+static struct {
+    volatile uint32_t stop;
+    volatile uint32_t probe_done;
+    std::atomic<uint32_t> running;
+    uint32_t wakeups;
+    uint32_t total;
+    uint32_t max;
+} bench_priority_results;
+
+static void priority_probe() {
+    auto& r = bench_priority_results;
+    // nobody ever unparks this word, so every wakeup comes from the deadline
+    static const volatile uint32_t never = 0;
+    for(uint32_t i=0; i<priority_probe_rounds; i++) {
+        uint64_t deadline = driver::timer::now() + priority_probe_period;
+        threads::park(&never, 0, deadline);
+        uint32_t latency = static_cast<uint32_t>(driver::timer::now() - deadline);
+        r.wakeups++;
+        r.total += latency;
+        r.max = std::max(r.max, latency);
+    }
+    r.probe_done = 1;
+    r.running--;
+}
+
+coroutine<void> bench_priorities(uint32_t busy, coroutine_name) {
+    busy = std::clamp(busy, 1u, max_busy_threads);
+    constexpr uint32_t busy_priority = 1;
+
+    kprintln("Wakeup latency of a thread sleeping {} us at a time, with {} busy threads of priority {}:",
+        priority_probe_period, busy, busy_priority);
+    for(uint32_t probe_priority : {busy_priority, config::thread_priorities - 1}) {
+        auto& r = bench_priority_results;
+        r.stop = 0;
+        r.probe_done = 0;
+        r.running = 0;
+        r.wakeups = r.total = r.max = 0;
+
+        for(uint32_t i=0; i<busy; i++) {
+            r.running++;
+            thread(threads::priority{busy_priority}, []() {
+                while(!bench_priority_results.stop) {}
+                bench_priority_results.running--;
+            }).detach();
+        }
+        r.running++;
+        thread(threads::priority{probe_priority}, &priority_probe).detach();
+
+        // this coroutine's thread ranks above the busy ones, it only gets to run while they are sleeping
+        while(!r.probe_done) {
+            co_await events::sleep_for(10000);
+        }
+        r.stop = 1;
+        while(r.running) {
+            co_await events::sleep_for(1000);
+        }
+
+        kprintln("  probe priority {}: {} us average, {} us max ({} wakeups)",
+            probe_priority, r.wakeups ? r.total / r.wakeups : 0, r.max, r.wakeups);
+    }
+}
+
+constexpr uint32_t max_sleeper_threads = 16;
+constexpr uint32_t sleeper_rounds = 20;
+constexpr uint32_t sleeper_period = 10000;
+
+static std::atomic<uint32_t> sleepers_running;
+
+coroutine<void> bench_sleepers(uint32_t count, coroutine_name) {
+    count = std::clamp(count, 1u, max_sleeper_threads);
+
+    kprintln("{} threads waiting {} times for {} us:", count, sleeper_rounds, sleeper_period);
+    for(bool block : {false, true}) {
+        uint64_t start = driver::timer::now();
+        uint64_t idle_start = threads::idle_time();
+
+        sleepers_running = count;
+        for(uint32_t i=0; i<count; i++) {
+            thread([block]() {
+                for(uint32_t round=0; round<sleeper_rounds; round++) {
+                    if(block) {
+                        threads::sleep_for(sleeper_period);
+                    } else {
+                        // what a thread had to do before it could sleep: poll the clock and hand on the CPU
+                        uint64_t until = driver::timer::now() + sleeper_period;
+                        while(driver::timer::now() < until) {
+                            threads::yield();
+                        }
+                    }
+                }
+                sleepers_running--;
+            }).detach();
+        }
+        while(sleepers_running) {
+            co_await events::sleep_for(sleeper_period);
+        }
+
+        // 32 bits are enough for over an hour, there is no libgcc for 64-bit division
+        uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+        uint32_t busy = elapsed - std::min(elapsed, static_cast<uint32_t>(threads::idle_time() - idle_start));
+        kprintln("  {:<13} CPU busy for {} of {} us ({}%)", block ? "sleep_for:" : "polling:",
+            busy, elapsed, elapsed >= 100 ? busy / (elapsed / 100) : 0);
+    }
+}
+
+constexpr uint32_t join_child_sleep = 1000;
+
+coroutine<void> bench_joins(uint32_t rounds, coroutine_name) {
+    // the children have the priority of the joining thread, so they only run when it blocks or its timeslice ends
+    constexpr threads::priority child_priority{config::main_thread_priority};
+
+    kprintln("Joining {} threads that sleep for {} us each:", rounds, join_child_sleep);
+    for(bool park : {false, true}) {
+        uint32_t total = 0;
+        uint32_t max = 0;
+        for(uint32_t i=0; i<rounds; i++) {
+            uint64_t start = driver::timer::now();
+            if(park) {
+                thread child{child_priority, []() {
+                    threads::sleep_for(join_child_sleep);
+                }};
+                child.join();
+            } else {
+                // how `thread::join` used to wait
+                static volatile uint32_t done;
+                done = 0;
+                thread(child_priority, []() {
+                    threads::sleep_for(join_child_sleep);
+                    done = 1;
+                }).detach();
+                while(!done) {}
+            }
+            uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+            total += elapsed;
+            max = std::max(max, elapsed);
+        }
+        kprintln("  {:<9} {} us average, {} us max", park ? "parking:" : "spinning:", total / rounds, max);
+    }
+    co_return;
+}
+
+}
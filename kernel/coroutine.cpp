@@ -0,0 +1,130 @@
+#include <kernel/coroutine.hpp>
+
+#include <config.hpp>
+#include <kernel/events.hpp>
+#include <kernel/sync.hpp>
+#include <lib/list.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+namespace kernel {
+
+namespace {
+    static_assert((config::coroutine_descriptor_slots & (config::coroutine_descriptor_slots - 1)) == 0,
+        "Number of coroutine descriptor slots must be a power of two");
+
+    struct descriptor_slot {
+        coroutine_descriptor descriptor{};
+        /** Set once the descriptor is complete, slots are looked up without taking the lock. */
+        std::atomic<bool> used{false};
+    };
+    descriptor_slot descriptors[config::coroutine_descriptor_slots]{};
+    mutex descriptors_lock{};
+    /** Shared by all coroutines created once the table is full, they lose their name and location. */
+    const coroutine_descriptor overflow_descriptor{"unnamed coroutine (too many coroutine names)", {}};
+    bool overflow_reported = false;
+
+    mutex registry_lock{};
+    list<detail::coroutine_record> registry{};
+
+    bool matches(const coroutine_descriptor& d, const char* name, const std::source_location& location) {
+        return d.name == name
+            && d.location.function_name() == location.function_name()
+            && d.location.line() == location.line()
+            && d.location.column() == location.column();
+    }
+}
+
+const coroutine_descriptor* detail::intern_coroutine_descriptor(const char* name, const std::source_location& location) {
+    constexpr std::size_t mask = config::coroutine_descriptor_slots - 1;
+    std::size_t start = (reinterpret_cast<uintptr_t>(name) ^ reinterpret_cast<uintptr_t>(location.function_name()) ^ location.line()) & mask;
+    for(std::size_t i = 0; i <= mask; i++) {
+        auto& slot = descriptors[(start + i) & mask];
+        if(!slot.used.load(std::memory_order_acquire)) {
+            break;
+        }
+        if(matches(slot.descriptor, name, location)) {
+            return &slot.descriptor;
+        }
+    }
+
+    // not found, insert it unless another thread did so in the meantime
+    lock_guard lock{descriptors_lock};
+    for(std::size_t i = 0; i <= mask; i++) {
+        auto& slot = descriptors[(start + i) & mask];
+        if(!slot.used.load(std::memory_order_relaxed)) {
+            slot.descriptor = coroutine_descriptor{name, location};
+            slot.used.store(true, std::memory_order_release);
+            return &slot.descriptor;
+        }
+        if(matches(slot.descriptor, name, location)) {
+            return &slot.descriptor;
+        }
+    }
+    if(!overflow_reported) {
+        overflow_reported = true;
+        debug::kwarn("Coroutine descriptor table is full, cannot add coroutine \"{}\" from {}", name, location);
+    }
+    return &overflow_descriptor;
+}
+
+void detail::register_coroutine(promise_base_base* promise) {
+    promise->set_state(coroutine_state::created);
+    lock_guard lock{registry_lock};
+    registry.push_back(promise);
+}
+void detail::unregister_coroutine(promise_base_base* promise) {
+    if(promise->event_loop) {
+        promise->event_loop->forget_record(promise);
+    }
+    lock_guard lock{registry_lock};
+    registry.remove(promise);
+}
+
+std::size_t coroutine_count() {
+    lock_guard lock{registry_lock};
+    return registry.size();
+}
+std::size_t coroutine_snapshots(coroutine_snapshot* out, std::size_t max) {
+    uint32_t now = static_cast<uint32_t>(driver::timer::now());
+    std::size_t n = 0;
+    lock_guard lock{registry_lock};
+    for(auto* r = registry.front(); r && n < max; r = registry.next(r)) {
+        auto* promise = static_cast<detail::promise_base_base*>(r);
+        new(&out[n++]) coroutine_snapshot{
+            .info = promise->info(),
+            .event_loop = promise->event_loop,
+            .state = r->state,
+            .waiting_on = r->waiting_on,
+            .resumes = r->resumes,
+            .cycles = r->cycles,
+            .suspended_for = r->state == coroutine_state::running ? 0 : now - r->suspended_at,
+        };
+    }
+    return n;
+}
+
+void kprint_value(ostream& out, const char*& format, coroutine_state value) {
+    detail::format_options options{};
+    detail::read_options(format, options);
+
+    switch(value) {
+        case coroutine_state::created:              out << detail::aligned("created", options); return;
+        case coroutine_state::running:              out << detail::aligned("running", options); return;
+        case coroutine_state::ready:                out << detail::aligned("ready", options); return;
+        case coroutine_state::sleeping:             out << detail::aligned("sleeping", options); return;
+        case coroutine_state::waiting_event:        out << detail::aligned("waiting for event", options); return;
+        case coroutine_state::waiting_subscription: out << detail::aligned("waiting for subscription", options); return;
+        case coroutine_state::waiting_coroutine:    out << detail::aligned("waiting for coroutine", options); return;
+        case coroutine_state::waiting_children:     out << detail::aligned("waiting for children", options); return;
+        case coroutine_state::waiting_channel:      out << detail::aligned("waiting for channel", options); return;
+        case coroutine_state::waiting_lock:         out << detail::aligned("waiting for lock", options); return;
+        case coroutine_state::waiting_offload:      out << detail::aligned("waiting for offload", options); return;
+        case coroutine_state::suspended:            out << detail::aligned("suspended", options); return;
+        default:                                    out << detail::aligned("INVALID!", options); return;
+    }
+}
+
+}
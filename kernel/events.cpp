@@ -1,16 +1,21 @@
 #include <kernel/events.hpp>
 
 #include <config.hpp>
+#include <drivers/mini_uart.hpp>
 #include <drivers/serial.hpp>
 #include <drivers/interrupt_controller.hpp>
 #include <drivers/timer.hpp>
+#include <arch/arm/cpu.hpp>
 #include <arch/arm/interrupts.hpp>
 #include <kernel/debug.hpp>
+#include <kernel/telemetry.hpp>
 #include <kernel/threads.hpp>
-#include <lib/queue.hpp>
+#include <lib/format.hpp>
 
+#include <algorithm>
 #include <cstdint>
 #include <type_traits>
+#include <utility>
 
 namespace kernel::events {
 
@@ -21,9 +26,13 @@ void configure() {
 
     driver::interrupts::enable_source(driver::interrupts::interrupt_source::sys_timer1);
     driver::interrupts::enable_source(driver::interrupts::interrupt_source::uart);
+    driver::interrupts::enable_source(driver::interrupts::interrupt_source::aux);
 
     driver::timer::setup(driver::timer::system_timer::sys_timer1, config::system_timer_interval,
-        [](driver::timer::system_timer, uint32_t value, cpu::interrupts::interrupt_context&, void*){
+        [](driver::timer::system_timer, uint32_t value, cpu::interrupts::interrupt_context& context, void*){
+            if(telemetry::enabled()) {
+                telemetry::record_sample(context.address);
+            }
             main_event_loop.fire_event(event{.type = type::system_timer, .data = value});
         }, nullptr);
 }
@@ -35,60 +44,424 @@ void run_main_event_loop() {
 
 void event_loop::run() {
     for(;;) {
+        // read before stepping, so anything posted during the step keeps the loop from parking
+        uint32_t sequence = wake_sequence;
         step();
-        threads::yield();
+        if(idle()) {
+            park(sequence);
+        } else {
+            threads::yield();
+        }
     }
 }
 void event_loop::step() {
-    if(counter % 10 == 0) {
-        fire_event({.type = type::tick, .data = counter});
-    }
+    thread = threads::current();
+    run_posted();
+    timer_wheel.advance(driver::timer::now());
     process_events();
     counter++;
 }
+bool event_loop::idle() {
+    for(const auto& q : event_queues) {
+        if(!q.empty()) {
+            return false;
+        }
+    }
+    return ready_queue.empty() && posted.load(std::memory_order_relaxed) == nullptr;
+}
+void event_loop::park(uint32_t sequence) {
+    uint64_t deadline = timer_wheel.next_deadline(driver::timer::now());
+    parked = true;
+    threads::park(&wake_sequence, sequence, deadline);
+    parked = false;
+    parks++;
+}
+void event_loop::post(posted_work* work) {
+    posted_work* head = posted.load(std::memory_order_relaxed);
+    do {
+        work->next = head;
+    } while(!posted.compare_exchange_weak(head, work, std::memory_order_release, std::memory_order_relaxed));
+    wake_sequence = wake_sequence + 1;
+    if(parked) {
+        threads::unpark(&wake_sequence);
+    }
+}
+void event_loop::run_posted() {
+    posted_work* work = posted.exchange(nullptr, std::memory_order_acquire);
+    // the queue is a stack, reverse it to run the work in the order it was posted
+    posted_work* ordered = nullptr;
+    while(work) {
+        posted_work* next = work->next;
+        work->next = ordered;
+        ordered = work;
+        work = next;
+    }
+    running_posted = ordered;
+    while(auto* w = running_posted) {
+        // the node may be freed by its function, which may also cancel nodes after it
+        running_posted = w->next;
+        w->func(*w, w->userdata);
+        posts_processed++;
+    }
+}
+bool event_loop::cancel_post(posted_work* work) {
+    for(auto** slot = &running_posted; *slot; slot = &(*slot)->next) {
+        if(*slot == work) {
+            *slot = work->next;
+            return true;
+        }
+    }
+    // producers only ever replace the head, so nodes behind it can be unlinked without them noticing
+    posted_work* head = posted.load(std::memory_order_acquire);
+    while(head == work) {
+        if(posted.compare_exchange_weak(head, work->next, std::memory_order_acquire, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    for(auto* w = head; w; w = w->next) {
+        if(w->next == work) {
+            w->next = work->next;
+            return true;
+        }
+    }
+    return false;
+}
+bool event_loop::is_current() const {
+    return thread == threads::current();
+}
+void event_loop::fire_tick(timers::timer&, void* loop) {
+    auto self = static_cast<event_loop*>(loop);
+    // Awaiters waiting for the next tick re-arm the timer when they register.
+    self->dispatch({.type = type::tick, .data = self->ticks++});
+}
+/**
+ * Takes a batch of up to `config::event_loop_budget` events from the event queues and processes them,
+ * interleaved with up to `config::event_loop_budget` resumes from the ready queue, so neither can starve the other.
+ * Only coroutines that were ready when the step started are resumed (plus weighted continuations),
+ * so coroutines yielding again wait for the next round. Whatever is left over is processed in the next step.
+ */
 void event_loop::process_events() {
-    if(read_pos != write_pos) {
-        event e = std::move(event_queue[read_pos++]);
-        if(read_pos == config::event_queue_size) {
-            read_pos = 0;
+    queued_event batch[config::event_loop_budget];
+    std::size_t events = take_events(batch);
+
+    std::size_t next_event = 0;
+    std::size_t yields = 0;
+    std::size_t round = ready_queue.size();
+    for(;;) {
+        bool worked = false;
+
+        if(next_event < events) {
+            const auto& [e, fired_at, p] = batch[next_event++];
+            if constexpr(config::event_loop_instrumentation) {
+                uint32_t latency = cpu::cycle_counter() - fired_at;
+                record_latency(p, latency);
+                histograms[static_cast<std::size_t>(e.type)].record(latency);
+            }
+            dispatch_event(e);
+            // ticks would flood the serial link
+            if(e.type != type::tick) {
+                telemetry::trace(telemetry::trace_point::event_dispatched, static_cast<uint32_t>(e.type));
+            }
+            events_processed++;
+            worked = true;
+        }
+        // yields destroyed during the step unlink themselves, so the queue can drain before the round ends
+        yield* y = nullptr;
+        if(yields < config::event_loop_budget && (round || (!ready_queue.empty() && ready_queue.front()->continuation))
+            && (y = ready_queue.pop_front())) {
+            if(y->continuation) {
+                ready_runs++;
+            } else {
+                round--;
+                ready_runs = 1;
+            }
+            ready_running = y->handle;
+            y->complete();
+            ready_running = nullptr;
+            yields++;
+            yields_processed++;
+            worked = true;
         }
 
-        auto& slot = event_awaiters[static_cast<uint32_t>(e.type)];;
-        auto* awaiter = slot;
-        if(awaiter) {
-            slot = nullptr;
-            awaiter->complete(e.data);
+        if(!worked) {
+            break;
+        }
+    }
+    if(events == config::event_loop_budget || yields == config::event_loop_budget) {
+        budget_exhausted++;
+    }
+}
+/**
+ * Fills `batch` with events ordered by priority class, see `config::event_dispatch_strict`.
+ */
+std::size_t event_loop::take_events(std::span<queued_event> batch) {
+    std::size_t count = 0;
+    if constexpr(config::event_dispatch_strict) {
+        for(auto& q : event_queues) {
+            count += q.pop(batch.subspan(count));
+        }
+        return count;
+    }
+
+    for(;;) {
+        std::size_t round = 0;
+        for(std::size_t p = 0; p < priority_count; p++) {
+            std::size_t take = std::min(config::event_priority_weights[p], batch.size() - count - round);
+            round += event_queues[p].pop(batch.subspan(count + round, take));
+        }
+        count += round;
+        if(round == 0 || count == batch.size()) {
+            return count;
+        }
+    }
+}
+void event_loop::dispatch_event(const event& e) {
+    for(auto* h = handlers[static_cast<uint32_t>(e.type)].front(); h; h = list<handler>::next(h)) {
+        h->m_calls++;
+        h->func(e, h->userdata);
+    }
+    deliver_to_subscriptions(e);
+
+    // Move all matching awaiters out of the wait queue first,
+    // so coroutines waiting again while being resumed only see the next event.
+    auto& waiters = event_awaiters[static_cast<uint32_t>(e.type)];
+    list<awaiter> ready;
+    for(auto* a = waiters.front(); a;) {
+        auto* next = list<awaiter>::next(a);
+        if(a->matches(e.data)) {
+            waiters.remove(a);
+            ready.push_back(a);
+        }
+        a = next;
+    }
+    // An awaiter destroyed by an earlier resume unlinks itself from `ready`.
+    while(auto* a = ready.pop_front()) {
+        a->complete(e.data);
+    }
+}
+void event_loop::dispatch(const event& e) {
+    auto current = current_coroutine;
+    dispatch_event(e);
+    current_coroutine = current;
+}
+void event_loop::add_timer(timers::timer* timer, uint64_t deadline) {
+    timer_wheel.add(timer, deadline, driver::timer::now());
+}
+event_loop_statistics event_loop::statistics() const {
+    event_loop_statistics stats{
+        .events_processed = events_processed,
+        .yields_processed = yields_processed,
+        .posts_processed = posts_processed,
+        .ready_queue_length = ready_queue.size(),
+        .ready_queue_high_water = ready_queue_high_water,
+        .steps = counter,
+        .budget_exhausted = budget_exhausted,
+        .parks = parks,
+    };
+    for(std::size_t p = 0; p < priority_count; p++) {
+        auto& c = stats.classes[p];
+        c.queue_depth = event_queues[p].size();
+        c.queue_high_water = queue_high_water[p];
+        c.queue_overruns = queue_overruns[p];
+        c.events_processed = latency[p].events_processed;
+        c.latency_max = latency[p].max;
+        c.latency_average = latency[p].average / 16;
+
+        stats.queue_depth += c.queue_depth;
+        stats.queue_high_water = std::max(stats.queue_high_water, c.queue_high_water);
+        stats.queue_overruns += c.queue_overruns;
+    }
+    return stats;
+}
+void event_loop::reset_statistics() {
+    for(auto& l : latency) {
+        l = {};
+    }
+    for(auto& h : histograms) {
+        h.reset();
+    }
+    runtimes.reset();
+    // owned by the producer, but losing an update while resetting does not hurt
+    for(std::size_t p = 0; p < priority_count; p++) {
+        queue_overruns[p] = 0;
+        queue_high_water[p] = 0;
+    }
+}
+static inline uint32_t fire_timestamp() {
+    if constexpr(config::event_loop_instrumentation) {
+        return cpu::cycle_counter();
+    } else {
+        return 0;
+    }
+}
+void event_loop::fire_event(event &&event, priority p) {
+    auto& q = event_queues[static_cast<std::size_t>(p)];
+    record_enqueue(p, 1, q.push({event, fire_timestamp(), p}) ? 1 : 0);
+}
+void event_loop::fire_events(std::span<const event> events) {
+    // one pass per priority keeps the order within each queue and records every queue once
+    uint32_t now = fire_timestamp();
+    for(std::size_t i = 0; i < priority_count; i++) {
+        auto p = static_cast<priority>(i);
+        auto& q = event_queues[i];
+        std::size_t requested = 0;
+        std::size_t queued = 0;
+        for(const auto& e : events) {
+            if(default_priority(e.type) != p) {
+                continue;
+            }
+            requested++;
+            // after the first failed push the queue is full, the rest of the run is an overrun
+            if(queued + 1 == requested && q.push({e, now, p})) {
+                queued++;
+            }
+        }
+        if(requested) {
+            record_enqueue(p, requested, queued);
         }
     }
+}
+void event_loop::fire_events(std::span<const event> events, priority p) {
+    auto& q = event_queues[static_cast<std::size_t>(p)];
+    uint32_t now = fire_timestamp();
+    std::size_t queued = 0;
+    for(const auto& e : events) {
+        if(!q.push({e, now, p})) {
+            break;
+        }
+        queued++;
+    }
+    record_enqueue(p, events.size(), queued);
+}
+void event_loop::record_enqueue(priority p, std::size_t requested, std::size_t queued) {
+    auto i = static_cast<std::size_t>(p);
+    if(queued) {
+        wake_sequence = wake_sequence + 1;
+        if(parked) {
+            threads::unpark_from_interrupt(&wake_sequence);
+        }
+    }
+    if(queued < requested) {
+        queue_overruns[i] = queue_overruns[i] + (requested - queued);
+    }
+    if(std::size_t depth = event_queues[i].size(); depth > queue_high_water[i]) {
+        queue_high_water[i] = depth;
+    }
+}
+void event_loop::record_latency(priority p, uint32_t latency) {
+    auto& l = this->latency[static_cast<std::size_t>(p)];
+    l.events_processed++;
+    l.max = std::max(l.max, latency);
+    // exponential moving average with a weight of 1/16, kept scaled by 16
+    l.average = l.average - l.average / 16 + latency;
+}
 
-    if(auto* y = yield_queue.remove()) {
-        y->complete();
+void event_loop::register_awaiter(awaiter* a) {
+    event_awaiters[static_cast<uint32_t>(a->type_)].push_back(a);
+    if(a->type_ == type::tick && !tick_timer.pending()) {
+        add_timer(&tick_timer, driver::timer::now() + config::event_loop_tick_interval);
     }
-    if(yield_queue.peek()) {
-        panic("Yield queue not empty after processing all yields");
+}
+void event_loop::yield_coroutine(yield *awaiter) {
+    // a weighted coroutine yielding while being resumed from the ready queue may go again right away
+    awaiter->continuation = awaiter->handle == ready_running && ready_runs < awaiter->weight;
+    if(awaiter->continuation) {
+        ready_queue.push_front(awaiter);
+    } else {
+        ready_queue.push_back(awaiter);
     }
+    ready_queue_high_water = std::max(ready_queue_high_water, ready_queue.size());
 }
-void event_loop::fire_event(event &&event) {
-    if(write_pos == read_pos-1) {
-        debug::kerror("Event queue overrun. Throwing away event of type {} with data {}.",
-            static_cast<std::underlying_type_t<type>>(event.type), event.data);
+void yield::hand_off(event_loop* target) {
+    if(target->is_current()) {
+        target->yield_coroutine(this);
         return;
     }
+    handoff.func = [](posted_work&, void* userdata) {
+        auto* y = static_cast<yield*>(userdata);
+        y->handoff_pending = false;
+        y->handoff_target->yield_coroutine(y);
+    };
+    handoff.userdata = this;
+    handoff_target = target;
+    handoff_pending = true;
+    target->post(&handoff);
+}
 
-    event_queue[write_pos++] = std::move(event);
-    if(write_pos == config::event_queue_size) {
-        write_pos = 0;
+void event_loop::add_subscription(basic_subscription* subscription) {
+    auto* slot = &subscriptions[static_cast<uint32_t>(subscription->event_type())];
+    while(*slot) {
+        slot = &(*slot)->next_subscription;
     }
+    *slot = subscription;
 }
+void event_loop::remove_subscription(basic_subscription* subscription) {
+    for(auto* slot = &subscriptions[static_cast<uint32_t>(subscription->event_type())]; *slot; slot = &(*slot)->next_subscription) {
+        if(*slot == subscription) {
+            *slot = subscription->next_subscription;
+            subscription->next_subscription = nullptr;
+            return;
+        }
+    }
+}
+void event_loop::deliver_to_subscriptions(const event& e) {
+    auto& head = subscriptions[static_cast<uint32_t>(e.type)];
+    for(auto* s = head; s; s = s->next_subscription) {
+        s->deliver(e.data);
+    }
 
-awaiter* event_loop::register_event_handler(type t, awaiter *a) {
-    auto& slot = event_awaiters[static_cast<uint32_t>(t)];
-    awaiter* old = slot;
-    slot = a;
-    return old;
+    // Resuming a coroutine may add or remove subscriptions, so restart the search after every resume.
+    for(;;) {
+        basic_subscription* ready = nullptr;
+        for(auto* s = head; s; s = s->next_subscription) {
+            if(s->resume_pending) {
+                ready = s;
+                break;
+            }
+        }
+        if(!ready) {
+            break;
+        }
+        ready->resume_pending = false;
+        auto handle = std::exchange(ready->waiter, nullptr);
+        debug::ktrace("Resuming coroutine {} for subscription \"{}\"", get_coroutine_info(handle), ready->name());
+
+        auto loop = get_event_loop(handle);
+        if(!loop) {
+            panic("Event loop is null");
+        }
+        loop->resume(handle);
+    }
 }
-void event_loop::yield_coroutine(yield *awaiter) {
-    yield_queue.add(awaiter);
+
+handler::handler(event_loop& loop, type t, function func, void* userdata, const char* name)
+    : m_type(t), func(func), userdata(userdata), m_name(name) {
+    loop.handlers[static_cast<uint32_t>(t)].push_back(this);
+}
+handler::~handler() {
+    unlink();
+}
+
+basic_subscription::basic_subscription(event_loop& loop, type t, const char* name, uint32_t* buffer, std::size_t capacity)
+    : loop(&loop), m_type(t), m_name(name), buffer(buffer), mask(capacity - 1) {
+    loop.add_subscription(this);
+}
+basic_subscription::~basic_subscription() {
+    loop->remove_subscription(this);
+}
+void basic_subscription::deliver(uint32_t data) {
+    if(depth() > mask) {
+        m_dropped++;
+        return;
+    }
+    buffer[write_pos++ & mask] = data;
+    m_delivered++;
+    if(depth() > m_high_water) {
+        m_high_water = depth();
+    }
+    if(waiter) {
+        resume_pending = true;
+    }
 }
 
 namespace detail {
@@ -112,9 +485,42 @@ namespace detail {
         if(check_interrupt(interrupt_source::uart)) {
             driver::serial::Serial.handle_interrupt();
         }
+        if(check_interrupt(interrupt_source::aux)) {
+            driver::mini_uart::MiniUart.handle_interrupt();
+        }
+        // the handlers may have woken a thread that ranks above the interrupted one
+        threads::preempt_if_needed(context);
 
         return context.result;
     }
 }
 
 }
+
+namespace kernel {
+    void kprint_value(ostream& out, const char*& format, events::type value) {
+        detail::format_options options{};
+        detail::read_options(format, options);
+
+        using events::type;
+        switch(value) {
+            case type::tick:         out << detail::aligned("tick", options); return;
+            case type::serial_rx:    out << detail::aligned("serial_rx", options); return;
+            case type::system_timer: out << detail::aligned("system_timer", options); return;
+            case type::user:         out << detail::aligned("user", options); return;
+            default:                 out << detail::aligned("INVALID!", options); return;
+        }
+    }
+    void kprint_value(ostream& out, const char*& format, events::priority value) {
+        detail::format_options options{};
+        detail::read_options(format, options);
+
+        using events::priority;
+        switch(value) {
+            case priority::high:   out << detail::aligned("high", options); return;
+            case priority::normal: out << detail::aligned("normal", options); return;
+            case priority::low:    out << detail::aligned("low", options); return;
+            default:               out << detail::aligned("INVALID!", options); return;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#include <kernel/fiber.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+extern "C" {
+    /**
+     * Saves the callee-saved registers on the current stack, stores the stack pointer to `*save_sp`
+     * and continues with the registers saved on the stack at `load_sp`, see arch/arm/context_switch.S.
+     */
+    void fiber_switch(void** save_sp, void* load_sp);
+    void fiber_entry();
+}
+
+namespace kernel {
+
+namespace {
+    /** r4-r11 and lr, as pushed by `fiber_switch`. */
+    constexpr std::size_t saved_registers = 9;
+}
+
+void* fiber::prepare(std::span<std::byte> stack, std::size_t size, std::size_t alignment) {
+    auto top = reinterpret_cast<uintptr_t>(stack.data() + stack.size());
+    // the AAPCS wants the stack pointer 8 byte aligned at calls, which is where the fiber starts
+    uintptr_t arg = (top - size) & ~(std::max<uintptr_t>(alignment, 8) - 1);
+    auto* frame = reinterpret_cast<uint32_t*>(arg) - saved_registers;
+    if(reinterpret_cast<uintptr_t>(frame) < reinterpret_cast<uintptr_t>(stack.data()) || arg > top) {
+        panic("Fiber stack is too small");
+    }
+    std::fill(frame, frame + saved_registers, 0);
+    frame[0] = reinterpret_cast<uint32_t>(this);                   // r4
+    frame[1] = reinterpret_cast<uint32_t>(&fiber::run);            // r5
+    frame[saved_registers - 1] = reinterpret_cast<uint32_t>(&fiber_entry); // lr
+    sp = frame;
+    return reinterpret_cast<void*>(arg);
+}
+
+bool fiber::resume() {
+    if(finished) {
+        return false;
+    }
+    if(running) {
+        panic("Fiber resumed while it is running");
+    }
+    running = started = true;
+    fiber_switch(&caller_sp, sp);
+    running = false;
+    return !finished;
+}
+
+void fiber::yield() {
+    if(!running) {
+        panic("Fiber yielded while it is not running");
+    }
+    fiber_switch(&sp, caller_sp);
+}
+
+void fiber::run(fiber* self) {
+    self->entry(*self, self->arg);
+    self->finished = true;
+    // the fiber is never resumed again, its stack pointer is not needed anymore
+    fiber_switch(&self->sp, self->caller_sp);
+    __builtin_unreachable();
+}
+
+}
@@ -36,4 +36,16 @@ const char* keqingheart = R"([0m[38;5;16m [0m[38;5;16m [0m[38;5;16m [0m[
 [0m[38;5;16m [0m[38;5;16m [0m[38;5;16m [0m[38;5;16m [0m[38;5;16m [0m[38;5;102m;[0m[38;5;182mk[0m[38;5;182mO[0m[38;5;182mO[0m[38;5;182mk[0m[38;5;139mo[0m[38;5;139ml[0m[38;5;103m:[0m[38;5;96m.[0m[38;5;188m0[0m[38;5;225mN[0m[38;5;230mW[0m[38;5;230mW[0m[38;5;230mN[0m[38;5;224mN[0m[38;5;224mX[0m[38;5;131m,[0m[38;5;174mc[0m[38;5;211mx[0m[38;5;210mx[0m[38;5;211mx[0m[38;5;211md[0m[38;5;210md[0m[38;5;210mo[0m[38;5;210ml[0m[38;5;204ml[0m[38;5;204ml[0m[38;5;204ml[0m[38;5;168mc[0m[38;5;95m'[0m[38;5;224mK[0m[38;5;224mN[0m[38;5;231mW[0m[38;5;230mW[0m[38;5;230mW[0m[38;5;230mW[0m[38;5;224mX[0m[38;5;95m'[0m[38;5;53m [0m[38;5;59m.[0m[38;5;187m0[0m[38;5;223mX[0m[38;5;180mx[0m[38;5;16m [0m[38;5;00m [0m[38;5;00m [0m[38;5;16m [0m[38;5;16m [0m[38;5;60m'[0m[38;5;146md[0m[38;5;182mk[0m[38;5;182mk[0m[38;5;146mk[0m[38;5;145mo[0m[38;5;146mk[0m[38;5;182mO[0m[38;5;146mk[0m[38;5;102m;[0m[38;5;59m.[0m
 )";
 
+generator<std::string_view> lines(const char* image, coroutine_name) {
+    std::string_view rest{image};
+    while(!rest.empty()) {
+        std::size_t end = rest.find('\n');
+        co_yield rest.substr(0, end);
+        if(end == std::string_view::npos) {
+            break;
+        }
+        rest.remove_prefix(end + 1);
+    }
+}
+
 }
@@ -7,6 +7,7 @@
 #include <config.hpp>
 #include <kernel/basic.hpp>
 #include <kernel/debug.hpp>
+#include <kernel/generator.hpp>
 #include <lib/string.hpp>
 
 namespace kernel {
@@ -125,6 +126,16 @@ void* malloc(size_t size)
     return ptr;
 }
 
+generator<memory_block> memory_blocks() {
+    for(mem_block* block = reinterpret_cast<mem_block*>(MEMORY); block; block = block->next) {
+        co_yield memory_block{
+            .address = reinterpret_cast<char*>(block) + sizeof(mem_block),
+            .size = block->size & size_mask,
+            .used = (block->size & used_mask) != 0,
+        };
+    }
+}
+
 void free(void* ptr)
 {
     kernel::debug::ktrace("free({})", ptr);
@@ -0,0 +1,62 @@
+#include <kernel/offload.hpp>
+
+#include <config.hpp>
+#include <kernel/sync.hpp>
+#include <kernel/threads.hpp>
+
+#include <algorithm>
+
+namespace kernel {
+
+namespace {
+    mutex queue_lock{};
+    list<detail::offload_task> queue{};
+    /** Incremented whenever a task is queued, idle workers park on it. */
+    volatile uint32_t work_sequence = 0;
+    offload_statistics stats{};
+
+    void worker(unsigned int id) {
+        debug::kdebug("Offload worker {} started.", id);
+        for(;;) {
+            uint32_t sequence = work_sequence;
+            detail::offload_task* task;
+            {
+                lock_guard lock{queue_lock};
+                task = queue.pop_front();
+            }
+            if(!task) {
+                threads::park(&work_sequence, sequence);
+                continue;
+            }
+            task->run(*task);
+            {
+                lock_guard lock{queue_lock};
+                stats.completed++;
+            }
+        }
+    }
+}
+
+void detail::submit_offload(offload_task* task) {
+    {
+        lock_guard lock{queue_lock};
+        queue.push_back(task);
+        stats.submitted++;
+        stats.queue_high_water = std::max(stats.queue_high_water, queue.size());
+    }
+    work_sequence = work_sequence + 1;
+    threads::unpark(&work_sequence);
+}
+
+void start_offload_workers() {
+    for(unsigned int i = 0; i < config::offload_workers; i++) {
+        thread(&worker, i).detach();
+    }
+}
+
+offload_statistics get_offload_statistics() {
+    lock_guard lock{queue_lock};
+    return stats;
+}
+
+}
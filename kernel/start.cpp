@@ -2,17 +2,25 @@
 #include <arch/arm/cpu.hpp>
 #include <arch/arm/interrupts.hpp>
 #include <drivers/gpio.hpp>
+#include <drivers/mini_uart.hpp>
 #include <drivers/serial.hpp>
 #include <drivers/timer.hpp>
 #include <drivers/interrupt_controller.hpp>
 #include <cstdint>
 #include <kernel/basic.hpp>
+#include <kernel/benchmarks.hpp>
+#include <kernel/cancellation.hpp>
 #include <kernel/images.hpp>
 #include <kernel/debug.hpp>
 #include <kernel/memory.hpp>
+#include <kernel/offload.hpp>
 #include <kernel/coroutine.hpp>
 #include <kernel/events.hpp>
+#include <kernel/generator.hpp>
 #include <kernel/supervisor.hpp>
+#include <kernel/sync.hpp>
+#include <kernel/task_group.hpp>
+#include <kernel/telemetry.hpp>
 #include <lib/format.hpp>
 #include <lib/string.hpp>
 #include <lib/bitfield.hpp>
@@ -31,7 +39,18 @@ void increment_counter() {
     counter = counter + 1;
 }
 
-coroutine<bool> terminal(std::span<char> buffer, const char* prompt = "$ ") {
+/**
+ * Streams the bytes received on the serial line, one `co_await next()` per byte.
+ */
+async_generator<int> serial_input(const char* subscriber, coroutine_name = "serial input") {
+    events::subscription<config::serial_subscription_size> input{events::main_event_loop, events::type::serial_rx, subscriber};
+    for(;;) {
+        int c = co_await input.next();
+        co_yield c;
+    }
+}
+
+coroutine<bool> terminal(std::span<char> buffer, events::basic_subscription& input, const char* prompt = "$ ") {
     using driver::serial::Serial;
 
     Serial << prompt;
@@ -42,7 +61,7 @@ coroutine<bool> terminal(std::span<char> buffer, const char* prompt = "$ ") {
     size_t i;
     bool okay = false;
     for(i = 0; i < buffer.size()-1;) {
-        char c = buffer[i] = co_await Serial.co_get();
+        char c = buffer[i] = co_await input.next();
         switch(c) {
             case '\r': // enter
             case '\n': // enter (when feeding QEMU from stdin)
@@ -76,12 +95,51 @@ coroutine<bool> terminal(std::span<char> buffer, const char* prompt = "$ ") {
     co_return okay;
 }
 
+coroutine<uint32_t> wait_for_key(events::basic_subscription& input, coroutine_name = "wait for key") {
+    co_return co_await input.next();
+}
+coroutine<void> wait_for_timeout(uint32_t seconds, coroutine_name = "wait for timeout") {
+    co_await events::sleep_for(seconds * 1000000ull);
+}
+uint32_t count_primes(uint32_t limit) {
+    uint32_t count = 0;
+    for(uint32_t n = 2; n < limit; n++) {
+        bool prime = true;
+        for(uint32_t d = 2; d * d <= n; d++) {
+            if(n % d == 0) {
+                prime = false;
+                break;
+            }
+        }
+        count += prime;
+    }
+    return count;
+}
+coroutine<void> print_lines(events::event_loop* loop, const char* name, async_mutex& console, coroutine_name = "print lines") {
+    co_await events::move_to_event_loop(loop);
+    for(int i = 0; i < 5; i++) {
+        // every line is printed in pieces, but no other coroutine can print in between
+        auto guard = co_await console.scoped_lock();
+        debug::kprint("[{}] line {}:", name, i);
+        for(int j = 0; j < 4; j++) {
+            co_await events::yield();
+            debug::kprint(" {}", j);
+        }
+        debug::kprintln("");
+    }
+    co_await events::move_to_event_loop(&events::main_event_loop);
+}
+
 void start_kernel() {
     using namespace driver::gpio;
     using namespace driver::serial;
     using debug::kprintln;
 
     Serial.begin();
+    driver::mini_uart::MiniUart.begin();
+    if constexpr (config::log_to_mini_uart) {
+        debug::log_stream = &driver::mini_uart::MiniUart;
+    }
     debug::kinfo("Kernel starting...");
 
     debug::kdebug("Configured stack pointers:");
@@ -101,6 +159,7 @@ void start_kernel() {
     debug::kdebug("Interrupt vector table is at {}.", &cpu::interrupts::_ivt);
     cpu::interrupts::setup_vector_table();
     cpu::interrupts::enable();
+    cpu::enable_cycle_counter();
 
     events::configure();
 
@@ -127,10 +186,18 @@ void start_kernel() {
     Serial << "\r\n";
 
     kprintln("Some sizes:");
-    kprintln("- sizeof(promise_base_base) = {}", sizeof(detail::promise_base<void>));
+    kprintln("- sizeof(promise_base_base) = {}", sizeof(detail::promise_base_base));
     kprintln("- sizeof(promise_base)      = {}", sizeof(detail::promise_base<void>));
     kprintln("- sizeof(promise<void>)     = {}", sizeof(promise<void>));
     kprintln("- sizeof(promise<int>)      = {}", sizeof(promise<int>));
+    {
+        // what a frame really takes on the heap, for a coroutine with nothing but its name
+        std::size_t before = malloc_stats().memory_used();
+        auto frame = [](coroutine_name = "frame size")->coroutine<void> { co_return; }();
+        std::size_t size = malloc_stats().memory_used() - before;
+        frame.release().destroy();
+        kprintln("- smallest coroutine frame  = {} ({} fit into the heap)", size, size ? malloc_stats().memory_total / size : 0);
+    }
 
     events::event_loop test{};
     test.submit_coroutine([](events::event_loop* test, coroutine_name = "test")->coroutine<void> {
@@ -154,16 +221,22 @@ void start_kernel() {
         int d = 8;
         thread([c = 7, d, &test](int a, int b){
             debug::kinfo("Hello from a thread! I captured {} {} and got as arguments {} {}.", a, b, c, d);
+            events::main_event_loop.post([]() {
+                debug::kinfo("Hello from the main event loop, on behalf of a thread!");
+            });
             test.run();
         }, 5, 6).detach();
     }
 
+    start_offload_workers();
+
     debug::kinfo("Kernel started. Entering event loop.");
 
     bool debug_mode = false;
     events::main_event_loop.submit_coroutine([&debug_mode](coroutine_name = "input debug")->coroutine<void> {
-        for(;;) {
-            int c = co_await Serial.co_get();
+        auto input = serial_input("input debug");
+        while(const int* next = co_await input.next()) {
+            int c = *next;
             if(!debug_mode) {
                 continue;
             }
@@ -177,24 +250,28 @@ void start_kernel() {
         }
     }());
     events::main_event_loop.submit_coroutine([&debug_mode](events::event_loop* test, coroutine_name = "terminal")->coroutine<void> {
+        events::subscription<config::serial_subscription_size> input{events::main_event_loop, events::type::serial_rx, "terminal"};
+        // Ctrl+C cancels the running command, if it supports that
+        cancellation_token interrupt;
+        events::handler ctrl_c{events::main_event_loop, events::type::serial_rx, [](const events::event& e, void* token) {
+            if(e.data == 0x03) {
+                static_cast<cancellation_token*>(token)->cancel();
+            }
+        }, &interrupt, "ctrl-c"};
         for(;;) {
             std::array<char, 256> line;
-            bool okay = co_await terminal(line, "kernel@localhost:/# ");
+            bool okay = co_await terminal(line, input, "kernel@localhost:/# ");
             if(!okay) {
                 debug::kwarn("Line too long, please keep it to {} characters.", line.size());
             }
             std::string_view sv(line.data());
+            interrupt.reset();
             if(sv == "hello") {
                 kprintln("world");
             }
             else if(sv == "keqing") {
-                char c;
-                for(const char* ptr = images::keqingheart; (c=*ptr); ptr++) {
-                    if(c == '\n') {
-                        Serial << "\r\n";
-                    } else {
-                        Serial << c;
-                    }
+                for(std::string_view line : images::lines(images::keqingheart)) {
+                    Serial << line << "\r\n";
                 }
             }
             else if(sv == "debug") {
@@ -213,6 +290,60 @@ void start_kernel() {
                 kprintln("    num_allocations  = {}", stats.num_allocations);
                 kprintln("    num_blocks       = {}", stats.num_blocks);
                 kprintln("    block_overhead   = {}", stats.block_overhead);
+                kprintln("  Log channel statistics:");
+                kprintln("    mini_uart_buffered = {}", driver::mini_uart::MiniUart.buffered());
+                kprintln("    mini_uart_dropped  = {}", driver::mini_uart::MiniUart.dropped());
+                kprintln("  Event loop statistics:");
+                auto loop_stats = events::main_event_loop.statistics();
+                kprintln("    queue_depth      = {}", loop_stats.queue_depth);
+                kprintln("    queue_high_water = {}", loop_stats.queue_high_water);
+                kprintln("    queue_overruns   = {}", loop_stats.queue_overruns);
+                kprintln("    events_processed = {}", loop_stats.events_processed);
+                kprintln("    yields_processed = {}", loop_stats.yields_processed);
+                kprintln("    posts_processed  = {}", loop_stats.posts_processed);
+                kprintln("    ready_queue      = {} (high water {})", loop_stats.ready_queue_length, loop_stats.ready_queue_high_water);
+                kprintln("    steps            = {}", loop_stats.steps);
+                kprintln("    budget_exhausted = {}", loop_stats.budget_exhausted);
+                kprintln("    parks            = {}", loop_stats.parks);
+                for(std::size_t p = 0; p < events::priority_count; p++) {
+                    const auto& c = loop_stats.classes[p];
+                    kprintln("    {:<6}: depth = {}, high water = {}, overruns = {}, processed = {}, latency = {} cycles average, {} cycles max",
+                        static_cast<events::priority>(p), c.queue_depth, c.queue_high_water, c.queue_overruns,
+                        c.events_processed, c.latency_average, c.latency_max);
+                }
+                kprintln("  Timer statistics:");
+                auto timer_stats = events::main_event_loop.timer_statistics();
+                kprintln("    pending            = {}", timer_stats.pending);
+                kprintln("    pending_high_water = {}", timer_stats.pending_high_water);
+                kprintln("    fired              = {}", timer_stats.fired);
+                kprintln("    cancelled          = {}", timer_stats.cancelled);
+                kprintln("    cascaded           = {}", timer_stats.cascaded);
+                kprintln("    batches            = {}", timer_stats.batches);
+                kprintln("    max_batch          = {}", timer_stats.max_batch);
+                kprintln("    max_slack          = {} us", timer_stats.max_slack);
+                kprintln("  Offload statistics:");
+                auto offload_stats = get_offload_statistics();
+                kprintln("    submitted        = {}", offload_stats.submitted);
+                kprintln("    completed        = {}", offload_stats.completed);
+                kprintln("    queue_high_water = {}", offload_stats.queue_high_water);
+                kprintln("  Event subscriptions:");
+                events::main_event_loop.for_each_subscription([](const events::basic_subscription& s) {
+                    kprintln("    {:<12} on {:<12}: depth = {}/{}, high water = {}, delivered = {}, dropped = {}",
+                        s.name(), s.event_type(), s.depth(), s.capacity(), s.high_water(), s.delivered(), s.dropped());
+                });
+                kprintln("  Event handlers:");
+                events::main_event_loop.for_each_handler([](const events::handler& h) {
+                    kprintln("    {:<12} on {:<12}: calls = {}", h.name(), h.event_type(), h.calls());
+                });
+            }
+            else if(sv == "heap") {
+                std::size_t used = 0;
+                std::size_t free = 0;
+                for(const auto& block : memory_blocks()) {
+                    kprintln("  {} {:>10} bytes {}", block.address, block.size, block.used ? "used" : "free");
+                    (block.used ? used : free) += block.size;
+                }
+                kprintln("{} bytes used, {} bytes free", used, free);
             }
             else if(sv.starts_with("malloc ")) {
                 sv.remove_prefix(std::char_traits<char>::length("malloc "));
@@ -254,9 +385,38 @@ void start_kernel() {
                 LEDs[led-1]->set(on);
                 kprintln("Turned LED {} {}.", led, on?"on":"off");
             }
+            else if(sv == "telemetry") {
+                telemetry::enable(!telemetry::enabled());
+                kprintln("Telemetry is {}.", telemetry::enabled()?"on":"off");
+            }
             else if(sv == "whoami") {
                 kprintln("I am {}!", get_coroutine_info(co_await get_coroutine_handle()));
             }
+            else if(sv == "ps") {
+                // copied first, printing must not hold up coroutines being created or destroyed elsewhere
+                std::size_t capacity = coroutine_count() + 4;
+                auto* entries = static_cast<coroutine_snapshot*>(malloc(capacity * sizeof(coroutine_snapshot)));
+                if(!entries) {
+                    kprintln("Not enough memory to list {} coroutines.", capacity);
+                    continue;
+                }
+                std::size_t count = coroutine_snapshots(entries, capacity);
+                kprintln("{:<10} {:<20} {:<24} {:<12} {:<10} {:>8} {:>10} {:>10}",
+                    "FRAME", "NAME", "STATE", "ON", "LOOP", "RESUMES", "KCYCLES", "SUSPENDED");
+                for(std::size_t i = 0; i < count; i++) {
+                    const auto& c = entries[i];
+                    debug::kprint("{} {:<20} {:<24} ", c.info.address(), c.info.name(), c.state);
+                    if(c.state == coroutine_state::waiting_event || c.state == coroutine_state::waiting_subscription) {
+                        debug::kprint("{:<12} ", static_cast<events::type>(c.waiting_on));
+                    } else {
+                        debug::kprint("{:<12} ", "-");
+                    }
+                    kprintln("{} {:>8} {:>10} {:>7} ms",
+                        c.event_loop, c.resumes, static_cast<uint32_t>(c.cycles >> 10), c.suspended_for / 1000);
+                }
+                kprintln("{} coroutines, {} bytes of heap in use", count, malloc_stats().memory_used());
+                free(entries);
+            }
             else if(sv == "trap") {
                 kprintln("Before trap");
                 // __builtin_trap is [[noreturn]] so we cannot use it here because we want to test continuation
@@ -293,24 +453,146 @@ void start_kernel() {
                 kprintln("Moved to test event loop {}", get_event_loop(co_await get_coroutine_handle()));
                 for(int i = 0; i < 10; i++) {
                     debug::kprint(".");
-                    for(int j=0; j<2500; j++) {
-                        co_await events::awaiter(events::type::tick);
-                    }
+                    co_await events::sleep_for(250000);
                 }
                 kprintln("");
                 co_await events::move_to_event_loop(&events::main_event_loop);
                 kprintln("Moved back to main event loop {}", get_event_loop(co_await get_coroutine_handle()));
             }
+            else if(sv == "primes" || sv.starts_with("primes ")) {
+                sv.remove_prefix(std::char_traits<char>::length("primes"));
+                uint32_t limit = string_to_integral<uint32_t>(sv).value_or(1000000);
+                uint64_t start = driver::timer::now();
+                // runs on a worker thread, the console stays responsive meanwhile
+                uint32_t primes = co_await offload([limit]() { return count_primes(limit); });
+                kprintln("There are {} primes below {} (took {} us).", primes, limit, static_cast<uint32_t>(driver::timer::now() - start));
+            }
+            else if(sv == "sync") {
+                async_mutex console;
+                co_await when_all(print_lines(test, "test", console), print_lines(&events::main_event_loop, "main", console));
+            }
+            else if(sv == "latency") {
+                auto& loop = events::main_event_loop;
+                auto loop_stats = loop.statistics();
+                kprintln("Event queues (latency in cycles):");
+                for(std::size_t p = 0; p < events::priority_count; p++) {
+                    const auto& c = loop_stats.classes[p];
+                    kprintln("  {:<6}: high water = {}, overruns = {}, processed = {}, average = {}, max = {}",
+                        static_cast<events::priority>(p), c.queue_high_water, c.queue_overruns,
+                        c.events_processed, c.latency_average, c.latency_max);
+                }
+                kprintln("Dispatch latency per event type (cycles):");
+                for(uint32_t t = 0; t < static_cast<uint32_t>(events::type::EVENT_TYPE_COUNT); t++) {
+                    const auto& h = loop.latency_histogram(static_cast<events::type>(t));
+                    if(!h.samples()) {
+                        continue;
+                    }
+                    kprintln("  {}: {} events, max = {}", static_cast<events::type>(t), h.samples(), h.max());
+                    for(std::size_t b = 0; b < h.buckets; b++) {
+                        if(h.count(b)) {
+                            kprintln("    >= {:>10}: {}", h.lower_bound(b), h.count(b));
+                        }
+                    }
+                }
+                kprintln("Coroutine run times (cycles):");
+                loop.coroutine_runtimes().for_each([](const instrumentation::coroutine_runtime& r) {
+                    // there is no libgcc for 64-bit division, fall back to kilocycles for large totals
+                    uint32_t kilocycles = static_cast<uint32_t>(r.cycles >> 10);
+                    uint32_t average = (r.cycles >> 32) ? (kilocycles / r.resumes) << 10 : static_cast<uint32_t>(r.cycles) / r.resumes;
+                    kprintln("  {:<16} resumes = {:>8}, total = {:>8}k, average = {:>8}, max = {:>8}",
+                        r.key.name, r.resumes, kilocycles, average, r.max);
+                });
+                if(auto untracked = loop.coroutine_runtimes().untracked()) {
+                    kprintln("  {} resumes of coroutines that did not fit into the table", untracked);
+                }
+            }
+            else if(sv == "latency reset") {
+                events::main_event_loop.reset_statistics();
+                kprintln("Reset event loop statistics.");
+            }
+            else if(sv == "idle" || sv.starts_with("idle ")) {
+                sv.remove_prefix(std::char_traits<char>::length("idle"));
+                uint32_t seconds = string_to_integral<uint32_t>(sv).value_or(5);
+                uint64_t start = driver::timer::now();
+                uint64_t idle_start = threads::idle_time();
+                if(!co_await cancellable(wait_for_timeout(seconds), interrupt)) {
+                    kprintln("Interrupted.");
+                    continue;
+                }
+                // 32 bits are enough for over an hour, there is no libgcc for 64-bit division
+                uint32_t elapsed = static_cast<uint32_t>(driver::timer::now() - start);
+                uint32_t idle = static_cast<uint32_t>(threads::idle_time() - idle_start);
+                kprintln("CPU was idle for {} of {} us ({}%)", idle, elapsed, elapsed >= 100 ? idle / (elapsed / 100) : 0);
+            }
+            else if(sv == "wait" || sv.starts_with("wait ")) {
+                sv.remove_prefix(std::char_traits<char>::length("wait"));
+                uint32_t seconds = string_to_integral<uint32_t>(sv).value_or(5);
+                kprintln("Press any key within {} seconds...", seconds);
+                // whichever finishes first cancels the other one
+                if(co_await when_any(wait_for_key(input), wait_for_timeout(seconds)) == 0) {
+                    kprintln("Key pressed.");
+                } else {
+                    kprintln("Timed out.");
+                }
+            }
+            else if(sv.starts_with("stress events")) {
+                sv.remove_prefix(std::char_traits<char>::length("stress events"));
+                uint32_t per_interrupt = string_to_integral<uint32_t>(sv).value_or(8);
+                co_await benchmarks::stress_event_queue(2000000, 100, per_interrupt);
+            }
+            else if(sv.starts_with("bench waiters")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench waiters"));
+                uint32_t waiters = string_to_integral<uint32_t>(sv).value_or(48);
+                co_await benchmarks::bench_waiters(waiters, 100);
+            }
+            else if(sv.starts_with("bench timers")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench timers"));
+                uint32_t count = string_to_integral<uint32_t>(sv).value_or(4096);
+                co_await benchmarks::bench_timers(count, 2000000);
+            }
+            else if(sv.starts_with("bench yields")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench yields"));
+                uint32_t count = string_to_integral<uint32_t>(sv).value_or(200);
+                co_await benchmarks::bench_yields(count, 100, 4);
+            }
+            else if(sv.starts_with("bench switches")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench switches"));
+                uint32_t rounds = string_to_integral<uint32_t>(sv).value_or(10000);
+                co_await benchmarks::bench_switches(rounds ? rounds : 1);
+            }
+            else if(sv.starts_with("bench priorities")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench priorities"));
+                uint32_t busy = string_to_integral<uint32_t>(sv).value_or(4);
+                co_await benchmarks::bench_priorities(busy);
+            }
+            else if(sv.starts_with("bench sleepers")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench sleepers"));
+                uint32_t count = string_to_integral<uint32_t>(sv).value_or(4);
+                co_await benchmarks::bench_sleepers(count);
+            }
+            else if(sv.starts_with("bench joins")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench joins"));
+                uint32_t rounds = string_to_integral<uint32_t>(sv).value_or(20);
+                co_await benchmarks::bench_joins(rounds ? rounds : 1);
+            }
+            else if(sv.starts_with("bench channels")) {
+                sv.remove_prefix(std::char_traits<char>::length("bench channels"));
+                uint32_t messages = string_to_integral<uint32_t>(sv).value_or(10000);
+                co_await benchmarks::bench_channels(messages);
+            }
             else if(sv == "help") {
                 kprintln("Available commands:");
                 kprintln("hello          - print \"world\"");
                 kprintln("keqing         - show a picture of Keqing");
                 kprintln("debug          - toggle debug mode");
-                kprintln("stats          - show (memory) stats");
+                kprintln("telemetry      - toggle binary telemetry frames on the console");
+                kprintln("stats          - show (memory and event) stats");
+                kprintln("heap           - list all blocks of dynamic memory");
                 kprintln("malloc <n>     - allocate n bytes of dynamic memory");
                 kprintln("free <p>       - free the memory at pointer p");
                 kprintln("led <n> on|off - turn LED n on or off");
                 kprintln("whoami         - print the name of the current coroutine");
+                kprintln("ps             - list all coroutines with their state and run time");
                 kprintln("trap           - trigger an undefined instruction exception");
                 kprintln("breakpoint     - trigger a prefetch abort exception");
                 kprintln("syscall        - trigger a software interrupt exception");
@@ -321,6 +603,20 @@ void start_kernel() {
                 kprintln("poweroff       - shut the system down");
                 kprintln("panic          - cause a kernel panic");
                 kprintln("move           - move around event loops");
+                kprintln("sync           - print from both event loops, one line at a time");
+                kprintln("primes [n]     - count the primes below n on a worker thread");
+                kprintln("idle [s]       - measure how long the CPU is idle within s seconds (Ctrl+C to stop)");
+                kprintln("wait [s]       - wait for a key press or s seconds, whichever comes first");
+                kprintln("latency [reset] - show (or reset) event latencies and coroutine run times");
+                kprintln("stress events [n] - flood the event queue with n events per timer interrupt");
+                kprintln("bench waiters [n] - benchmark event dispatch with n concurrent (filtered) waiters");
+                kprintln("bench timers [n]  - benchmark the timing wheel with n pending timers");
+                kprintln("bench yields [n]  - benchmark the ready queue with n yielding coroutines");
+                kprintln("bench channels [n] - benchmark passing n messages through channels and the event queue");
+                kprintln("bench switches [n] - compare n fiber switches, thread yields and switches, and coroutine resumptions");
+                kprintln("bench priorities [n] - measure thread wakeup latency against n busy low priority threads");
+                kprintln("bench sleepers [n] - compare the CPU time of n threads polling the timer and sleeping");
+                kprintln("bench joins [n]   - compare joining n threads by spinning and by parking");
                 kprintln("help           - display this help message");
             }
             else if(sv.empty()) {
@@ -331,12 +627,34 @@ void start_kernel() {
             }
         }
     }(&test));
-    events::main_event_loop.submit_coroutine([&debug_mode](coroutine_name = "timer")->coroutine<void> {
+    events::handler timer{events::main_event_loop, events::type::system_timer,
+        [](const events::event&, void* debug_mode) {
+            if(*static_cast<bool*>(debug_mode)) {
+                debug::kprint("!");
+            }
+        }, &debug_mode, "timer"};
+    events::main_event_loop.submit_coroutine([](coroutine_name = "telemetry")->coroutine<void> {
         while(true) {
             co_await events::awaiter(events::type::system_timer);
-            if(debug_mode) {
-                debug::kprint("!");
+            if(!telemetry::enabled()) {
+                continue;
             }
+
+            std::size_t subscription_dropped = 0;
+            events::main_event_loop.for_each_subscription([&subscription_dropped](const events::basic_subscription& s) {
+                subscription_dropped += s.dropped();
+            });
+            const auto& stats = malloc_stats();
+            telemetry::send_counters({
+                {telemetry::counter::memory_allocated, stats.memory_allocated},
+                {telemetry::counter::memory_free, stats.memory_free()},
+                {telemetry::counter::num_allocations, stats.num_allocations},
+                {telemetry::counter::num_blocks, stats.num_blocks},
+                {telemetry::counter::subscription_dropped, subscription_dropped},
+                {telemetry::counter::log_dropped, driver::mini_uart::MiniUart.dropped()},
+                {telemetry::counter::profiler_dropped, telemetry::samples_dropped()},
+            });
+            telemetry::flush_samples();
         }
         co_return;
     }());
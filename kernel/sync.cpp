@@ -0,0 +1,167 @@
+#include <kernel/sync.hpp>
+
+namespace kernel {
+
+bool async_mutex::lock_slow(lock_awaiter* waiter, std::coroutine_handle<> handle) {
+    lock_guard lock{guard};
+    // mark the mutex as contended, so the owner looks at the queue when unlocking
+    if(state.exchange(contended, std::memory_order_acquire) == unlocked) {
+        waiter->acquired = true;
+        return false;
+    }
+    waiter->handle = handle;
+    set_coroutine_state(handle, coroutine_state::waiting_lock);
+    waiters.push_back(waiter);
+    if(auto loop = get_event_loop(handle)) {
+        loop->current_coroutine = nullptr;
+    }
+    return true;
+}
+void async_mutex::unlock_slow() {
+    lock_guard lock{guard};
+    auto* next = waiters.pop_front();
+    if(!next) {
+        state.store(unlocked, std::memory_order_release);
+        return;
+    }
+    // hand the mutex over without unlocking it, so nobody can barge in before the next waiter runs
+    if(waiters.empty()) {
+        state.store(locked, std::memory_order_relaxed);
+    }
+    next->acquired = true;
+    next->wakeup.schedule(next->handle);
+}
+void async_mutex::lock_for(lock_awaiter* waiter, std::coroutine_handle<> handle) {
+    lock_guard lock{guard};
+    waiter->handle = handle;
+    if(state.exchange(contended, std::memory_order_acquire) == unlocked) {
+        waiter->acquired = true;
+        waiter->wakeup.schedule(handle);
+        return;
+    }
+    waiters.push_back(waiter);
+}
+async_mutex::lock_awaiter::~lock_awaiter() {
+    if(resumed) {
+        return;
+    }
+    // the coroutine frame might be destroyed while waiting, or after getting the mutex but before running again
+    bool owned;
+    {
+        lock_guard lock{mutex->guard};
+        unlink();
+        owned = acquired && !resumed;
+    }
+    if(owned) {
+        mutex->unlock();
+    }
+}
+
+bool async_semaphore::acquire_slow(acquire_awaiter* waiter, std::coroutine_handle<> handle) {
+    lock_guard lock{guard};
+    // permits are only returned while holding the lock, so none can get lost between checking and queueing
+    if(try_acquire()) {
+        waiter->acquired = true;
+        return false;
+    }
+    waiter->handle = handle;
+    set_coroutine_state(handle, coroutine_state::waiting_lock);
+    waiters.push_back(waiter);
+    if(auto loop = get_event_loop(handle)) {
+        loop->current_coroutine = nullptr;
+    }
+    return true;
+}
+void async_semaphore::release(uint32_t count) {
+    lock_guard lock{guard};
+    for(; count > 0; count--) {
+        auto* next = waiters.pop_front();
+        if(!next) {
+            permits.fetch_add(count, std::memory_order_release);
+            return;
+        }
+        next->acquired = true;
+        next->wakeup.schedule(next->handle);
+    }
+}
+async_semaphore::acquire_awaiter::~acquire_awaiter() {
+    if(resumed) {
+        return;
+    }
+    // the coroutine frame might be destroyed while waiting, or after getting a permit but before running again
+    bool owned;
+    {
+        lock_guard lock{semaphore->guard};
+        unlink();
+        owned = acquired && !resumed;
+    }
+    if(owned) {
+        semaphore->release();
+    }
+}
+
+void async_condition_variable::wait_slow(wait_awaiter* waiter, std::coroutine_handle<> handle) {
+    {
+        lock_guard lock{guard};
+        waiter->handle = handle;
+        set_coroutine_state(handle, coroutine_state::waiting_lock);
+        waiters.push_back(waiter);
+        if(auto loop = get_event_loop(handle)) {
+            loop->current_coroutine = nullptr;
+        }
+    }
+    // queued before unlocking, so a notification right after unlocking is not lost
+    waiter->relock.mutex->unlock();
+}
+void async_condition_variable::notify_one() {
+    lock_guard lock{guard};
+    if(auto* waiter = waiters.pop_front()) {
+        waiter->relock.mutex->lock_for(&waiter->relock, waiter->handle);
+    }
+}
+void async_condition_variable::notify_all() {
+    lock_guard lock{guard};
+    while(auto* waiter = waiters.pop_front()) {
+        waiter->relock.mutex->lock_for(&waiter->relock, waiter->handle);
+    }
+}
+async_condition_variable::wait_awaiter::~wait_awaiter() {
+    if(resumed) {
+        return;
+    }
+    // the coroutine frame might be destroyed while waiting, the mutex queue is taken care of by `relock`
+    lock_guard lock{cv->guard};
+    unlink();
+}
+
+void mutex::lock_slow(uint32_t seen) {
+    // from now on the mutex counts as contended, whoever unlocks it has to wake a parked thread
+    if(seen != contended) {
+        seen = std::atomic_ref(state).exchange(contended, std::memory_order_acquire);
+    }
+    while(seen != unlocked) {
+        threads::park(&state, contended);
+        seen = std::atomic_ref(state).exchange(contended, std::memory_order_acquire);
+    }
+}
+
+void condition_variable::wait(mutex& m) {
+    uint32_t seen = std::atomic_ref(sequence).load(std::memory_order_relaxed);
+    m.unlock();
+    threads::park(&sequence, seen);
+    // there may be more woken threads wanting the mutex, so take it as contended
+    uint32_t state = std::atomic_ref(m.state).exchange(mutex::contended, std::memory_order_acquire);
+    if(state != mutex::unlocked) {
+        m.lock_slow(state);
+    }
+}
+void condition_variable::notify_one() {
+    std::atomic_ref(sequence).fetch_add(1, std::memory_order_release);
+    threads::wake(&sequence, 1);
+}
+void condition_variable::notify_all() {
+    std::atomic_ref(sequence).fetch_add(1, std::memory_order_release);
+    threads::unpark(&sequence);
+}
+
+}
@@ -0,0 +1,145 @@
+#include <kernel/telemetry.hpp>
+
+#include <config.hpp>
+#include <drivers/serial.hpp>
+#include <drivers/timer.hpp>
+#include <kernel/sync.hpp>
+#include <lib/ring_buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kernel::telemetry {
+
+ostream* stream = &driver::serial::Serial;
+
+static volatile bool telemetry_enabled = false;
+static ring_buffer<uint32_t, config::telemetry_sample_buffer_size> samples{};
+static volatile std::size_t dropped_samples = 0;
+static mutex send_lock{};
+
+bool enabled() {
+    return telemetry_enabled;
+}
+void enable(bool on) {
+    telemetry_enabled = on;
+}
+
+frame::frame(channel ch) {
+    put(static_cast<uint8_t>(ch));
+}
+frame& frame::put(uint8_t byte) {
+    if(m_size < sizeof(data)) {
+        data[m_size++] = byte;
+    }
+    return *this;
+}
+frame& frame::varint(uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        put(value ? (byte | 0x80) : byte);
+    } while(value);
+    return *this;
+}
+std::size_t frame::send(ostream& out) const {
+    uint8_t raw[sizeof(data) + 2];
+    for(std::size_t i=0; i<m_size; i++) {
+        raw[i] = data[i];
+    }
+    uint16_t crc = crc16(data, m_size);
+    raw[m_size] = crc & 0xff;
+    raw[m_size+1] = crc >> 8;
+
+    // room for the delimiters around the encoded frame
+    uint8_t encoded[sizeof(raw) + sizeof(raw)/254 + 3];
+    std::size_t n = cobs_encode(raw, m_size + 2, encoded + 1);
+    encoded[0] = 0;
+    encoded[n + 1] = 0;
+
+    // frames from different event loops must not interleave on the wire
+    lock_guard lock{send_lock};
+    out.write(reinterpret_cast<const char*>(encoded), n + 2);
+    return n + 2;
+}
+
+void send_counters(std::initializer_list<std::pair<counter, uint32_t>> counters) {
+    frame f{channel::counters};
+    for(const auto& [id, value] : counters) {
+        // one id byte and up to five bytes for the value
+        if(!f.fits(6)) {
+            f.send(*stream);
+            f = frame{channel::counters};
+        }
+        f.varint(static_cast<uint8_t>(id)).varint(value);
+    }
+    f.send(*stream);
+}
+
+void trace(trace_point id, uint32_t arg) {
+    if(!enabled()) {
+        return;
+    }
+    frame f{channel::trace};
+    f.varint(static_cast<uint8_t>(id)).varint(static_cast<uint32_t>(driver::timer::now())).varint(arg);
+    f.send(*stream);
+}
+
+void record_sample(uint32_t pc) {
+    if(!samples.push(pc)) {
+        dropped_samples = dropped_samples + 1;
+    }
+}
+void flush_samples() {
+    frame f{channel::profiler};
+    uint32_t pc;
+    while(samples.pop(pc)) {
+        if(!f.fits(5)) {
+            f.send(*stream);
+            f = frame{channel::profiler};
+        }
+        f.varint(pc);
+    }
+    if(f.size() > 1) {
+        f.send(*stream);
+    }
+}
+std::size_t samples_dropped() {
+    return dropped_samples;
+}
+
+uint16_t crc16(const uint8_t* data, std::size_t size) {
+    uint16_t crc = 0xffff;
+    for(std::size_t i=0; i<size; i++) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for(int bit=0; bit<8; bit++) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+std::size_t cobs_encode(const uint8_t* in, std::size_t size, uint8_t* out) {
+    std::size_t code_pos = 0;
+    std::size_t out_pos = 1;
+    uint8_t code = 1;
+    for(std::size_t i=0; i<size; i++) {
+        if(in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = out_pos++;
+            code = 1;
+            continue;
+        }
+        out[out_pos++] = in[i];
+        code++;
+        if(code == 0xff) {
+            out[code_pos] = code;
+            code_pos = out_pos++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    return out_pos;
+}
+
+}
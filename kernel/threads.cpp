@@ -7,9 +7,13 @@
 #include <config.hpp>
 #include <kernel/supervisor.hpp>
 #include <lib/format.hpp>
+#include <lib/list.hpp>
 #include <lib/string.hpp>
 #include <lib/queue.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
 #include <limits>
 #include <sys/types.h>
@@ -30,6 +34,7 @@ void kprint_value(ostream& out, const char*& format, thread_create_error value)
         case thread_create_error::no_free_thread: out << aligned("no_free_thread", options); return;
         case thread_create_error::out_of_argument_memory: out << aligned("out_of_argument_memory", options); return;
         case thread_create_error::no_more_thread_ids: out << aligned("no_more_thread_ids", options); return;
+        case thread_create_error::invalid_priority: out << aligned("invalid_priority", options); return;
     }
 }
 
@@ -42,6 +47,7 @@ enum class thread_state {
 enum class thread_wait_type {
     sleep,
     uart,
+    park,
 };
 
 constexpr uint32_t default_psr = std::to_underlying(cpu::cpu_mode::usr);
@@ -53,27 +59,72 @@ constexpr uint32_t default_psr = std::to_underlying(cpu::cpu_mode::usr);
 void yield() {
     __asm__ __volatile__("mov r0, #5\nsvc #0" : : : "r0");
 }
+void park(const volatile uint32_t* word, uint32_t expected, uint64_t deadline) {
+    register uint32_t r0 __asm__("r0") = 6;
+    register const volatile uint32_t* r1 __asm__("r1") = word;
+    register uint32_t r2 __asm__("r2") = expected;
+    register uint32_t r3 __asm__("r3") = static_cast<uint32_t>(deadline);
+    register uint32_t r4 __asm__("r4") = static_cast<uint32_t>(deadline >> 32);
+    __asm__ __volatile__("svc #0" : "+r"(r0) : "r"(r1), "r"(r2), "r"(r3), "r"(r4) : "memory");
+}
+uint32_t wake(const volatile uint32_t* word, uint32_t count) {
+    register uint32_t r0 __asm__("r0") = 7;
+    register const volatile uint32_t* r1 __asm__("r1") = word;
+    register uint32_t r2 __asm__("r2") = count;
+    __asm__ __volatile__("svc #0" : "+r"(r0) : "r"(r1), "r"(r2) : "memory");
+    return r0;
+}
+void unpark(const volatile uint32_t* word) {
+    wake(word, std::numeric_limits<uint32_t>::max());
+}
+void sleep_until(uint64_t deadline) {
+    register uint32_t r0 __asm__("r0") = 9;
+    register uint32_t r1 __asm__("r1") = static_cast<uint32_t>(deadline);
+    register uint32_t r2 __asm__("r2") = static_cast<uint32_t>(deadline >> 32);
+    __asm__ __volatile__("svc #0" : "+r"(r0) : "r"(r1), "r"(r2) : "memory");
+}
+void sleep_for(uint64_t microseconds) {
+    sleep_until(driver::timer::now() + microseconds);
+}
+void wait_for(wait_source source, uint32_t sequence, uint64_t deadline) {
+    register uint32_t r0 __asm__("r0") = 10;
+    register uint32_t r1 __asm__("r1") = std::to_underlying(source);
+    register uint32_t r2 __asm__("r2") = sequence;
+    register uint32_t r3 __asm__("r3") = static_cast<uint32_t>(deadline);
+    register uint32_t r4 __asm__("r4") = static_cast<uint32_t>(deadline >> 32);
+    __asm__ __volatile__("svc #0" : "+r"(r0) : "r"(r1), "r"(r2), "r"(r3), "r"(r4) : "memory");
+}
+
+static_assert(config::thread_priorities > 0 && config::thread_priorities <= 32, "Thread priorities must fit into the ready bitmap");
+static_assert(config::thread_default_priority < config::thread_priorities && config::main_thread_priority < config::thread_priorities,
+    "Thread priority out of range");
 
-struct thread_control_block : public queue_mixin<thread_control_block> {
+/** A thread is in the ready queue while it is ready and in the waiting queue while it is waiting. */
+struct thread_control_block : public queue_mixin<thread_control_block>, public list_mixin<thread_control_block> {
+    /** In the order of STM/LDM and SRS/RFE, see the fast switch paths in arch/arm/context_switch.S. */
     struct registers {
         uint32_t r[13]{};
-        uint32_t lr = reinterpret_cast<uint32_t>(&terminate);
         uint32_t sp{};
+        uint32_t lr = reinterpret_cast<uint32_t>(&terminate);
         uint32_t pc{};
         uint32_t psr = default_psr;
     } registers{};
 
     thread_control_block() = default;
-    thread_control_block(entry_point pc, void* sp, uint32_t arg) : thread_control_block() {
+    thread_control_block(entry_point pc, void* sp, uint32_t arg, uint32_t priority = config::thread_default_priority) : thread_control_block() {
         registers.pc = reinterpret_cast<uint32_t>(pc);
         registers.sp = reinterpret_cast<uint32_t>(sp);
         registers.r[0] = arg;
         state = thread_state::ready;
+        this->priority = priority;
     }
 
     thread_state state = thread_state::empty;
+    uint32_t priority = config::thread_default_priority;
     thread_wait_type wait_type{};
     uint32_t wait_arg{};
+    /** Time at which a waiting thread is woken up even if nobody else woke it, 0 if none. */
+    uint64_t wake_at{};
 
     bool is_empty() const {
         return state == thread_state::empty;
@@ -98,16 +149,87 @@ struct thread_control_block : public queue_mixin<thread_control_block> {
     }
 };
 
+/**
+ * Ready threads, in one FIFO per priority. Bit `p` of `nonempty` is set while there are threads of priority `p`,
+ * so finding the highest ready priority takes a single CLZ, however many threads there are.
+ */
+class run_queue {
+        queue<thread_control_block> queues[config::thread_priorities]{};
+        uint32_t nonempty = 0;
+    public:
+        void add(thread_control_block* thread) {
+            queues[thread->priority].add(thread);
+            nonempty |= 1u << thread->priority;
+        }
+        thread_control_block* remove() {
+            if(!nonempty) {
+                return nullptr;
+            }
+            uint32_t priority = 31 - std::countl_zero(nonempty);
+            auto thread = queues[priority].remove();
+            if(!queues[priority].peek()) {
+                nonempty &= ~(1u << priority);
+            }
+            return thread;
+        }
+        /** Highest priority of any ready thread, -1 if there is none. */
+        int top_priority() const {
+            return 31 - std::countl_zero(nonempty);
+        }
+};
+
+static_assert(offsetof(struct thread_control_block::registers, pc) == 60 && sizeof(struct thread_control_block::registers) == 68,
+    "The fast switch paths in arch/arm/context_switch.S depend on the register layout");
+
 static thread_control_block threads[config::thread_count];
 static uintptr_t thread_stacks[config::thread_count];
+/** Runs whenever no other thread is ready, it is never part of the ready queue. */
+static thread_control_block idle_thread;
+static uint64_t idle_microseconds = 0;
 
 static struct thread_control_block* thread_running = NULL;
-static queue<thread_control_block> thread_ready_queue{};
-static queue<thread_control_block> thread_waiting_queue{};
+/**
+ * Registers of the running thread, the fast switch paths save the interrupted thread here.
+ * Points to the main thread from the start, so interrupts before `init` have somewhere to go.
+ */
+extern "C" {
+    struct thread_control_block::registers* thread_running_registers = &threads[0].registers;
+    /** Where the fast switch paths reset the SVC and IRQ stack pointers to, in that order. */
+    extern const uintptr_t fast_switch_stack_tops[2] = {config::stackpointers.svc, config::stackpointers.irq};
+    void svc_fast_path();
+    void irq_fast_path();
+}
+static run_queue thread_ready_queue{};
+/**
+ * Waiting threads, ordered by `wake_at` with the ones without a deadline at the end,
+ * so only the front has to be looked at to find out which ones are due.
+ */
+static list<thread_control_block> thread_waiting_queue{};
+static volatile uint32_t wait_sequences[std::to_underlying(wait_source::count)]{};
 
 void scheduler_timer_tick(system_timer, uint32_t, interrupt_context& ctx, void*);
+void wakeup_timer_tick(system_timer, uint32_t, interrupt_context& ctx, void*);
+void arm_timeslice(const thread_control_block* thread);
 interrupt_result terminate_thread(interrupt_context& ctx, void*);
 interrupt_result yield_thread(interrupt_context& ctx, void*);
+interrupt_result park_thread(interrupt_context& ctx, void*);
+interrupt_result unpark_threads(interrupt_context& ctx, void*);
+interrupt_result start_ready_thread(interrupt_context& ctx, void*);
+interrupt_result sleep_thread(interrupt_context& ctx, void*);
+interrupt_result wait_thread(interrupt_context& ctx, void*);
+
+[[noreturn]] static void idle(void*) {
+    for(;;) {
+        // Interrupts stay masked around the WFI, so only the time actually spent waiting is counted.
+        // A pending interrupt still wakes the CPU up and is taken right after unmasking.
+        __asm__ __volatile__("cpsid i" ::: "memory");
+        uint64_t before = driver::timer::now();
+        __asm__ __volatile__("wfi" ::: "memory");
+        idle_microseconds += driver::timer::now() - before;
+        __asm__ __volatile__("cpsie i" ::: "memory");
+        yield();
+    }
+}
 
 void init() {
     uintptr_t base = config::end_of_kernel + 6*config::mode_stack_size;
@@ -117,19 +239,46 @@ void init() {
         threads[i] = {};
     }
     threads[0].state = thread_state::running;
+    threads[0].priority = config::main_thread_priority;
     thread_running = &threads[0];
 
+    // The idle thread runs in system mode, WFI is not available in user mode.
+    idle_thread = thread_control_block(&idle,
+        reinterpret_cast<void*>(base + config::thread_count*config::thread_stack_size + config::idle_thread_stack_size), 0);
+    idle_thread.registers.psr = std::to_underlying(cpu::cpu_mode::sys);
+
+    // compare channel 3 ends the timeslice of the running thread, it is armed whenever a thread is switched to
     driver::interrupts::enable_source(driver::interrupts::interrupt_source::sys_timer3);
-    driver::timer::setup(system_timer::sys_timer3, config::system_timer_interval, scheduler_timer_tick, nullptr);
+    // compare channel 2 is armed on demand for the earliest deadline of a parked thread
+    driver::interrupts::enable_source(driver::interrupts::interrupt_source::sys_timer2);
 
     kernel::register_svc(0x04, &terminate_thread, nullptr);
     kernel::register_svc(0x05, &yield_thread, nullptr);
+    kernel::register_svc(0x06, &park_thread, nullptr);
+    kernel::register_svc(0x07, &unpark_threads, nullptr);
+    kernel::register_svc(0x08, &start_ready_thread, nullptr);
+    kernel::register_svc(0x09, &sleep_thread, nullptr);
+    kernel::register_svc(0x0a, &wait_thread, nullptr);
+    set_fast_switch(true);
+
+    arm_timeslice(thread_running);
+}
+
+const void* current() {
+    // only ever changes while the caller is switched out
+    return thread_running;
+}
+uint64_t idle_time() {
+    return idle_microseconds;
 }
 
 static unsigned int thread_id = 1;
 
 namespace detail {
-    std::expected<prepared_thread, thread_create_error> prepare_thread(entry_point entry, std::size_t args_size) {
+    std::expected<prepared_thread, thread_create_error> prepare_thread(entry_point entry, std::size_t args_size, priority prio) {
+        if(prio.value >= config::thread_priorities)
+            return std::unexpected(thread_create_error::invalid_priority);
+
         if(thread_id == std::numeric_limits<unsigned int>::max())
             return std::unexpected(thread_create_error::no_more_thread_ids);
 
@@ -152,18 +301,21 @@ namespace detail {
         char* args_pointer = stackpointer;
         stackpointer -= reinterpret_cast<uintptr_t>(stackpointer) % 8;
 
-        *block = thread_control_block(entry, stackpointer, reinterpret_cast<uint32_t>(args_pointer));
+        *block = thread_control_block(entry, stackpointer, reinterpret_cast<uint32_t>(args_pointer), prio.value);
         return prepared_thread{thread_id++, block, args_pointer};
     }
 
     std::expected<unsigned int, thread_create_error> start_thread(prepared_thread thread) {
-        thread_ready_queue.add(reinterpret_cast<thread_control_block*>(thread.block));
+        // through the kernel, so the new thread runs right away if it has a higher priority than the caller
+        register uint32_t r0 __asm__("r0") = 8;
+        register void* r1 __asm__("r1") = thread.block;
+        __asm__ __volatile__("svc #0" : "+r"(r0) : "r"(r1) : "memory");
         return thread.id;
     }
 };
 
-std::expected<unsigned int, thread_create_error> create(entry_point entry, const void* args, std::size_t args_size) {
-    auto prepared = detail::prepare_thread(entry, args_size);
+std::expected<unsigned int, thread_create_error> create(entry_point entry, const void* args, std::size_t args_size, priority prio) {
+    auto prepared = detail::prepare_thread(entry, args_size, prio);
     if(!prepared)
         return std::unexpected(prepared.error());
 
@@ -175,30 +327,140 @@ std::expected<unsigned int, thread_create_error> create(entry_point entry, const
     return *res;
 }
 
+thread_control_block* thread_current() {
+    return thread_running;
+}
 void thread_preempt() {
     thread_running->state = thread_state::ready;
-    thread_ready_queue.add(thread_running);
+    if(thread_running != &idle_thread) {
+        thread_ready_queue.add(thread_running);
+    }
     thread_running = nullptr;
 }
+/** Priority of a thread for scheduling decisions, the idle thread ranks below all others. */
+int priority_of(const thread_control_block* thread) {
+    if(!thread || thread == &idle_thread) {
+        return -1;
+    }
+    return static_cast<int>(thread->priority);
+}
+/**
+ * Starts the timeslice of a thread that was just switched to, when it ends the next ready thread
+ * of the same priority gets its turn.
+ */
+void arm_timeslice(const thread_control_block* thread) {
+    if(thread == &idle_thread) {
+        return;
+    }
+    uint32_t slice = config::thread_timeslices[thread->priority];
+    while(!driver::timer::set_alarm(system_timer::sys_timer3, static_cast<uint32_t>(driver::timer::now()) + slice, scheduler_timer_tick, nullptr)) {
+        // the slice is long enough that this can only happen if an FIQ delayed us
+    }
+}
 thread_control_block* thread_continue_next() {
     thread_running = thread_ready_queue.remove();
     if(!thread_running) {
-        panic("No more threads to run. Event loop thread probably crashed.");
+        thread_running = &idle_thread;
     }
     thread_running->state = thread_state::running;
+    thread_running_registers = &thread_running->registers;
+    arm_timeslice(thread_running);
     return thread_running;
 }
-thread_control_block* thread_current() {
-    return thread_running;
+void thread_wake(thread_control_block* thread) {
+    thread_waiting_queue.remove(thread);
+    thread->state = thread_state::ready;
+    thread->wake_at = 0;
+    thread_ready_queue.add(thread);
+}
+
+/**
+ * Wakes every waiting thread whose deadline has passed and arms the wakeup timer for the earliest remaining one.
+ * The compare register only reaches 2^31 microseconds ahead, so far deadlines are approached in steps,
+ * every step re-arming the timer from `wakeup_timer_tick`.
+ */
+void arm_wakeup_timer() {
+    constexpr uint64_t max_alarm_distance = uint64_t{1} << 30;
+    for(;;) {
+        uint64_t now = driver::timer::now();
+        auto first = thread_waiting_queue.front();
+        while(first && first->wake_at && first->wake_at <= now) {
+            thread_wake(first);
+            first = thread_waiting_queue.front();
+        }
+        if(!first || !first->wake_at) {
+            return;
+        }
+        uint64_t at = std::min(first->wake_at, now + max_alarm_distance);
+        if(driver::timer::set_alarm(system_timer::sys_timer2, static_cast<uint32_t>(at), wakeup_timer_tick, nullptr)) {
+            return;
+        }
+        // the deadline passed while arming the timer, go again
+    }
+}
+
+/**
+ * Moves the running thread onto the waiting queue and switches to the next ready one.
+ */
+void thread_block(interrupt_context& ctx, thread_wait_type type, uint32_t arg, uint64_t deadline) {
+    auto current = thread_current();
+    current->save_registers(ctx);
+    current->state = thread_state::waiting;
+    current->wait_type = type;
+    current->wait_arg = arg;
+    current->wake_at = deadline;
+    thread_running = nullptr;
+
+    auto position = thread_waiting_queue.front();
+    if(deadline) {
+        while(position && position->wake_at && position->wake_at <= deadline) {
+            position = thread_waiting_queue.next(position);
+        }
+    } else {
+        position = nullptr;
+    }
+    thread_waiting_queue.insert_before(position, current);
+    if(deadline && thread_waiting_queue.front() == current) {
+        arm_wakeup_timer();
+    }
+
+    auto next = thread_continue_next();
+    next->restore_registers(ctx);
+}
+/**
+ * Wakes up to `count` waiting threads of the given type and argument, returns how many were woken.
+ */
+uint32_t thread_wake_all(thread_wait_type type, uint32_t arg, uint32_t count = std::numeric_limits<uint32_t>::max()) {
+    uint32_t woken = 0;
+    for(auto t = thread_waiting_queue.front(); t && woken < count;) {
+        auto next = thread_waiting_queue.next(t);
+        if(t->wait_type == type && t->wait_arg == arg) {
+            thread_wake(t);
+            woken++;
+        }
+        t = next;
+    }
+    return woken;
 }
-thread_control_block* thread_peek_next() {
-    return thread_ready_queue.peek();
+
+void preempt_if_needed(interrupt_context& ctx) {
+    auto current = thread_current();
+    if(!current || thread_ready_queue.top_priority() <= priority_of(current)) {
+        return;
+    }
+    current->save_registers(ctx);
+    thread_preempt();
+    thread_continue_next()->restore_registers(ctx);
 }
 
 void scheduler_timer_tick(system_timer, uint32_t, interrupt_context& ctx, void*) {
     ctx.result = yield_thread(ctx, nullptr);
 }
 
+void wakeup_timer_tick(system_timer, uint32_t, interrupt_context&, void*) {
+    arm_wakeup_timer();
+}
+
 interrupt_result terminate_thread(interrupt_context& ctx, void*) {
     thread_current()->state = thread_state::empty;
 
@@ -207,12 +469,24 @@ interrupt_result terminate_thread(interrupt_context& ctx, void*) {
     return interrupt_result::next;
 }
 
+/**
+ * Whether a yield of `current` switches threads: only threads of the same or a higher priority get a turn,
+ * lower ones wait until it blocks.
+ */
+bool yield_switches(const thread_control_block* current) {
+    int top = thread_ready_queue.top_priority();
+    return top >= 0 && top >= priority_of(current);
+}
+
 interrupt_result yield_thread(interrupt_context& ctx, void*) {
-    if(!thread_peek_next()) {
+    auto current = thread_current();
+    if(!yield_switches(current)) {
+        if(current) {
+            arm_timeslice(current);
+        }
         return interrupt_result::next;
     }
 
-    auto current = thread_current();
     if(current) {
         current->save_registers(ctx);
         thread_preempt();
@@ -225,4 +499,110 @@ interrupt_result yield_thread(interrupt_context& ctx, void*) {
     return interrupt_result::next;
 }
 
+interrupt_result park_thread(interrupt_context& ctx, void*) {
+    auto word = reinterpret_cast<const volatile uint32_t*>(ctx.registers.r[1]);
+    uint32_t expected = ctx.registers.r[2];
+    uint64_t deadline = (static_cast<uint64_t>(ctx.registers.r[4]) << 32) | ctx.registers.r[3];
+
+    // interrupts are disabled in here, so nobody can change the word between this check and parking
+    if(*word != expected || (deadline && deadline <= driver::timer::now())) {
+        return interrupt_result::next;
+    }
+
+    thread_block(ctx, thread_wait_type::park, reinterpret_cast<uint32_t>(word), deadline);
+    return interrupt_result::next;
+}
+
+void unpark_from_interrupt(const volatile uint32_t* word) {
+    thread_wake_all(thread_wait_type::park, reinterpret_cast<uint32_t>(word));
+}
+
+interrupt_result unpark_threads(interrupt_context& ctx, void*) {
+    // the result has to be in place before a switch saves the registers
+    ctx.registers.r[0] = thread_wake_all(thread_wait_type::park, ctx.registers.r[1], ctx.registers.r[2]);
+    preempt_if_needed(ctx);
+    return interrupt_result::next;
+}
+
+interrupt_result start_ready_thread(interrupt_context& ctx, void*) {
+    thread_ready_queue.add(reinterpret_cast<thread_control_block*>(ctx.registers.r[1]));
+    preempt_if_needed(ctx);
+    return interrupt_result::next;
+}
+
+interrupt_result sleep_thread(interrupt_context& ctx, void*) {
+    uint64_t deadline = (static_cast<uint64_t>(ctx.registers.r[2]) << 32) | ctx.registers.r[1];
+    if(deadline <= driver::timer::now()) {
+        return interrupt_result::next;
+    }
+    thread_block(ctx, thread_wait_type::sleep, 0, deadline);
+    return interrupt_result::next;
+}
+
+/** The kind of wait of a thread blocked on an interrupt source. */
+thread_wait_type wait_type_of(wait_source source) {
+    switch(source) {
+        case wait_source::uart: return thread_wait_type::uart;
+        default: panic("Invalid wait source");
+    }
+}
+
+uint32_t wait_sequence(wait_source source) {
+    return wait_sequences[std::to_underlying(source)];
+}
+
+interrupt_result wait_thread(interrupt_context& ctx, void*) {
+    auto source = static_cast<wait_source>(ctx.registers.r[1]);
+    uint32_t sequence = ctx.registers.r[2];
+    uint64_t deadline = (static_cast<uint64_t>(ctx.registers.r[4]) << 32) | ctx.registers.r[3];
+    if(source >= wait_source::count) {
+        panic("Invalid wait source");
+    }
+
+    // like parking, the interrupt cannot come in between this check and blocking
+    if(wait_sequence(source) != sequence || (deadline && deadline <= driver::timer::now())) {
+        return interrupt_result::next;
+    }
+    thread_block(ctx, wait_type_of(source), 0, deadline);
+    return interrupt_result::next;
+}
+
+void wake_from_interrupt(wait_source source) {
+    auto& sequence = wait_sequences[std::to_underlying(source)];
+    sequence = sequence + 1;
+    thread_wake_all(wait_type_of(source), 0);
+}
+
+void set_fast_switch(bool enabled) {
+    using cpu::interrupts::interrupt_type;
+    cpu::interrupts::set_vector_entry(interrupt_type::software_interrupt, enabled ? &svc_fast_path : nullptr);
+    cpu::interrupts::set_vector_entry(interrupt_type::irq, enabled ? &irq_fast_path : nullptr);
+}
+
+/**
+ * Called by `svc_fast_path` for a yield, once the registers of the running thread are saved.
+ * Returns the registers of the thread to continue.
+ */
+extern "C" struct thread_control_block::registers* thread_fast_yield() {
+    auto current = thread_current();
+    if(!yield_switches(current)) {
+        arm_timeslice(current);
+        return &current->registers;
+    }
+    thread_preempt();
+    return &thread_continue_next()->registers;
+}
+
+/**
+ * Called by `irq_fast_path` once the registers of the running thread are saved. Handles the end of a timeslice
+ * like a yield, returns `nullptr` if any other interrupt is pending, which goes through `handle_interrupt`.
+ */
+extern "C" struct thread_control_block::registers* thread_fast_timeslice() {
+    if(!thread_current() || !driver::interrupts::check_only_interrupt(driver::interrupts::interrupt_source::sys_timer3)) {
+        return nullptr;
+    }
+    driver::timer::acknowledge(system_timer::sys_timer3);
+    return thread_fast_yield();
+}
+
 }
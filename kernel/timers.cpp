@@ -0,0 +1,150 @@
+#include <kernel/timers.hpp>
+
+#include <kernel/basic.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace kernel::timers {
+
+void timer::cancel() {
+    if(wheel) {
+        wheel->cancel(this);
+    }
+}
+
+void timing_wheel::add(timer* t, uint64_t deadline, uint64_t now) {
+    if(!t->func) {
+        panic("Tried to add a timer without a callback");
+    }
+    t->cancel();
+
+    if(empty()) {
+        // nothing is pending, so the wheel can skip all ticks up to now
+        current = to_tick(now);
+    }
+    t->m_deadline = deadline;
+    // round up, a timer must never fire before its deadline
+    t->expires = to_tick(deadline + tick - 1);
+    t->wheel = this;
+    insert(t);
+
+    stats.added++;
+    stats.pending_high_water = std::max(stats.pending_high_water, pending());
+}
+
+void timing_wheel::cancel(timer* t) {
+    if(t->wheel != this) {
+        panic("Tried to cancel a timer on a wheel it is not in");
+    }
+    t->unlink();
+    t->wheel = nullptr;
+    stats.cancelled++;
+}
+
+void timing_wheel::insert(timer* t) {
+    int32_t delta = static_cast<int32_t>(t->expires - current);
+    if(delta <= 0) {
+        due.push_back(t);
+        return;
+    }
+
+    for(unsigned int level = 0; level < levels; level++) {
+        unsigned int shift = level * level_bits;
+        if(static_cast<uint32_t>(delta) < (1u << (shift + level_bits))) {
+            wheel[level][(t->expires >> shift) & (slots - 1)].push_back(t);
+            return;
+        }
+    }
+    // out of range, park it as far away as possible, it is re-inserted when that slot is cascaded
+    constexpr unsigned int shift = (levels - 1) * level_bits;
+    uint32_t parked = current + (1u << (levels * level_bits)) - 1;
+    wheel[levels - 1][(parked >> shift) & (slots - 1)].push_back(t);
+}
+
+void timing_wheel::cascade(unsigned int level) {
+    auto& slot = wheel[level][(current >> (level * level_bits)) & (slots - 1)];
+    while(auto* t = slot.pop_front()) {
+        insert(t);
+        stats.cascaded++;
+    }
+}
+
+std::size_t timing_wheel::advance(uint64_t now) {
+    uint32_t target = to_tick(now);
+    if(empty()) {
+        current = target;
+        return 0;
+    }
+
+    list<timer> expired;
+    while(static_cast<int32_t>(target - current) > 0) {
+        current++;
+        // when a level wraps around, the next slot of the level above is due to be spread out below
+        for(unsigned int level = 1; level < levels; level++) {
+            if(current & ((1u << (level * level_bits)) - 1)) {
+                break;
+            }
+            cascade(level);
+        }
+        auto& slot = wheel[0][current & (slots - 1)];
+        while(auto* t = slot.pop_front()) {
+            expired.push_back(t);
+        }
+    }
+    while(auto* t = due.pop_front()) {
+        expired.push_back(t);
+    }
+
+    // A callback may cancel timers of the same batch, those unlink themselves from `expired`.
+    std::size_t fired = 0;
+    while(auto* t = expired.pop_front()) {
+        t->wheel = nullptr;
+        stats.fired++;
+        stats.max_slack = std::max(stats.max_slack, static_cast<uint32_t>(now - t->m_deadline));
+        fired++;
+        t->func(*t, t->userdata);
+    }
+    if(fired) {
+        stats.batches++;
+        stats.max_batch = std::max(stats.max_batch, fired);
+    }
+    return fired;
+}
+
+uint64_t timing_wheel::next_deadline(uint64_t now) const {
+    if(empty()) {
+        return 0;
+    }
+    if(!due.empty()) {
+        return now;
+    }
+
+    uint32_t earliest = std::numeric_limits<uint32_t>::max();
+    for(unsigned int level = 0; level < levels; level++) {
+        unsigned int shift = level * level_bits;
+        uint32_t index = current >> shift;
+        // the current slot of every level has already been processed, start with the next one
+        for(uint32_t i = 1; i <= slots; i++) {
+            if(!wheel[level][(index + i) & (slots - 1)].empty()) {
+                earliest = std::min(earliest, ((index + i) << shift) - current);
+                break;
+            }
+        }
+    }
+    if(earliest == std::numeric_limits<uint32_t>::max()) {
+        return 0;
+    }
+    // extend the last processed tick to 64 bits with the help of `now`
+    uint64_t current_tick = (now >> tick_shift) - static_cast<uint32_t>(to_tick(now) - current);
+    return (current_tick + earliest) << tick_shift;
+}
+
+timer_statistics timing_wheel::statistics() const {
+    timer_statistics result = stats;
+    result.pending = pending();
+    return result;
+}
+
+}
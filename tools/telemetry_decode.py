@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""
+Demultiplexes the kernel's serial output into console text and telemetry frames.
+
+Telemetry frames are COBS encoded and enclosed in 0x00 bytes (see include/kernel/telemetry.hpp),
+everything else is console text and is passed through unchanged.
+
+Usage:
+    qemu-system-arm -M raspi2b -nographic -kernel build/kernel.elf | tools/telemetry_decode.py
+    tools/telemetry_decode.py serial.log
+"""
+
+import argparse
+import sys
+
+CHANNELS = {1: "counters", 2: "trace", 3: "profiler"}
+
+# keep in sync with kernel::telemetry::counter
+COUNTERS = [
+    "memory_allocated",
+    "memory_free",
+    "num_allocations",
+    "num_blocks",
+    "subscription_dropped",
+    "log_dropped",
+    "profiler_dropped",
+]
+
+# keep in sync with kernel::telemetry::trace_point
+TRACE_POINTS = [
+    "event_dispatched",
+]
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            raise ValueError("invalid COBS block")
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def varints(data):
+    value = 0
+    shift = 0
+    for byte in data:
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            yield value
+            value = 0
+            shift = 0
+
+
+def describe(channel, payload):
+    values = list(varints(payload))
+    if channel == 1:
+        pairs = zip(values[0::2], values[1::2])
+        return " ".join(
+            "{}={}".format(COUNTERS[i] if i < len(COUNTERS) else "counter{}".format(i), v) for i, v in pairs)
+    if channel == 2 and len(values) == 3:
+        name = TRACE_POINTS[values[0]] if values[0] < len(TRACE_POINTS) else "id={}".format(values[0])
+        return "{} t={}us arg={:#x}".format(name, values[1], values[2])
+    if channel == 3:
+        return " ".join("{:#010x}".format(pc) for pc in values)
+    return payload.hex()
+
+
+def decode_frame(encoded):
+    raw = cobs_decode(encoded)
+    if len(raw) < 3:
+        raise ValueError("frame too short")
+    body, crc = raw[:-2], raw[-2] | (raw[-1] << 8)
+    if crc16(body) != crc:
+        raise ValueError("CRC mismatch")
+    return body[0], body[1:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="file to read from (default: stdin)")
+    parser.add_argument("--frames-only", action="store_true", help="do not pass console text through")
+    args = parser.parse_args()
+
+    source = open(args.input, "rb") if args.input else sys.stdin.buffer
+    text = sys.stdout.buffer
+    stats = {"frames": 0, "frame_bytes": 0, "errors": 0}
+
+    in_frame = False
+    frame = bytearray()
+    while True:
+        chunk = source.read1(4096) if hasattr(source, "read1") else source.read(4096)
+        if not chunk:
+            break
+        for byte in chunk:
+            if byte == 0:
+                if in_frame and frame:
+                    try:
+                        channel, payload = decode_frame(bytes(frame))
+                        stats["frames"] += 1
+                        stats["frame_bytes"] += len(frame) + 2
+                        line = "[telemetry {}] {}\n".format(CHANNELS.get(channel, channel), describe(channel, payload))
+                        text.write(line.encode())
+                    except ValueError as e:
+                        stats["errors"] += 1
+                        sys.stderr.write("[telemetry] dropped frame: {}\n".format(e))
+                    frame.clear()
+                    in_frame = False
+                else:
+                    # an empty frame (two delimiters in a row) is used for resynchronization
+                    frame.clear()
+                    in_frame = True
+            elif in_frame:
+                frame.append(byte)
+            elif not args.frames_only:
+                text.write(bytes((byte,)))
+        text.flush()
+
+    sys.stderr.write("[telemetry] {frames} frames, {frame_bytes} bytes, {errors} errors\n".format(**stats))
+
+
+if __name__ == "__main__":
+    main()